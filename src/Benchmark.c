@@ -0,0 +1,462 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark.h"
+#include "Environment.h"
+#include "Communication.h"
+#include "LaborDivision.h"
+#include "Physics.h"
+#include "Properties.h"
+#include "State.h"
+#include "Log.h"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LIST 64
+
+/*
+ * The physics term sets.  Each row gives the value of every flag in setTargets,
+ * except for config which leaves the [Physics] section as it was read in.
+ */
+#define NSETS 5
+#define NFLAGS 13
+const char * setNames[NSETS] = {"config", "hydro", "thermal", "mhd", "full"};
+int * setTargets[NFLAGS] = {&momEquation, &momAdvection, &viscosity,
+    &tEquation, &tDiff, &tempAdvection, &tempBackground, &buoyancy,
+    &magEquation, &magDiff, &magAdvect, &lorentz, &magBuoy};
+const int setFlags[NSETS][NFLAGS] = {
+    {0},
+    {1, 1, 1,   0, 0, 0, 0, 0,   0, 0, 0, 0, 0},
+    {1, 1, 1,   1, 1, 1, 1, 1,   0, 0, 0, 0, 0},
+    {1, 1, 1,   0, 0, 0, 0, 0,   1, 1, 1, 1, 0},
+    {1, 1, 1,   1, 1, 1, 1, 1,   1, 1, 1, 1, 0}};
+
+typedef struct
+{
+    int nx;
+    int ny;
+    int nz;
+    int hdiv;
+    int vdiv;
+    int set;
+    int fft;
+    double fftTime;     //seconds per forward/backward pair
+    double stepTime;    //seconds per call to iterate()
+    double fftStrong;
+    double stepStrong;
+    double fftWeak;
+    double stepWeak;
+} benchCase;
+
+//Results are only kept on grank 0, which is always a compute node
+benchCase * cases = 0;
+int ncases = 0;
+
+int splitList(char * list, char ** entries);
+void timeCase(benchCase * c);
+void scaling();
+void writeResults();
+
+/*
+ * Runs every combination of grid, decomposition, FFT routine and physics set.
+ * The decomposition is rebuilt from scratch for each grid and decomposition,
+ * but the FFT routine and physics can be switched without tearing anything
+ * down.
+ */
+int benchmark(char * propLoc)
+{
+    int i,j,k,l;
+    char * entries[MAX_LIST];
+    int n;
+
+    int grids[MAX_LIST][3];
+    int decomps[MAX_LIST][2];
+    int sets[MAX_LIST];
+    int ffts[MAX_LIST];
+    int ngrids = 0;
+    int ndecomps = 0;
+    int nsets = 0;
+    int nffts = 0;
+
+    loadPrefs(propLoc);
+
+    //Anything that is not listed falls back on the rest of the config file
+    if(benchGrids)
+    {
+        n = splitList(benchGrids, entries);
+        for(i = 0; i < n; i++)
+        {
+            if(sscanf(entries[i], "%dx%dx%d", &grids[ngrids][0], &grids[ngrids][1], &grids[ngrids][2]) == 3)
+                ngrids++;
+            else
+            {
+                warn("Ignoring benchmark grid %s\n", entries[i]);
+            }
+        }
+    }
+    else
+    {
+        grids[0][0] = nx;
+        grids[0][1] = ny;
+        grids[0][2] = nz;
+        ngrids = 1;
+    }
+
+    //Only the time integration is timed, so one IO node is plenty
+    n_io_nodes = 1;
+
+    if(benchDecomps)
+    {
+        n = splitList(benchDecomps, entries);
+        for(i = 0; i < n; i++)
+        {
+            if(sscanf(entries[i], "%dx%d", &decomps[ndecomps][0], &decomps[ndecomps][1]) == 2)
+                ndecomps++;
+            else
+            {
+                warn("Ignoring benchmark decomposition %s\n", entries[i]);
+            }
+        }
+    }
+    else
+    {
+        if(autoDecomp)
+            lab_chooseLayout();
+        decomps[0][0] = hdiv;
+        decomps[0][1] = vdiv;
+        ndecomps = 1;
+    }
+
+    //The decompositions are set explicitly from here on
+    autoDecomp = 0;
+
+    if(benchPhysics)
+    {
+        n = splitList(benchPhysics, entries);
+        for(i = 0; i < n; i++)
+        {
+            j = 0;
+            while(j < NSETS && strcmp(entries[i], setNames[j]) != 0)
+                j++;
+
+            if(j < NSETS)
+                sets[nsets++] = j;
+            else
+            {
+                warn("Ignoring unknown benchmark physics set %s\n", entries[i]);
+            }
+        }
+    }
+    else
+    {
+        sets[0] = 0;
+        nsets = 1;
+    }
+
+    if(benchFFTs)
+    {
+        n = splitList(benchFFTs, entries);
+        for(i = 0; i < n; i++)
+        {
+            ffts[nffts] = atoi(entries[i]);
+            if(ffts[nffts] >= FFT1 && ffts[nffts] <= NFFT)
+                nffts++;
+            else
+            {
+                warn("Ignoring benchmark fft %s\n", entries[i]);
+            }
+        }
+    }
+    else
+    {
+        for(i = 0; i < NFFT; i++)
+            ffts[i] = i + 1;
+        nffts = NFFT;
+    }
+
+    if(benchSteps < 1)
+        benchSteps = 1;
+    if(benchRepeats < 1)
+        benchRepeats = 1;
+    if(benchWarmup < 0)
+        benchWarmup = 0;
+
+    //Start from nothing, with nothing that needs to be read off disk
+    startFlag = SCRATCH;
+    momStaticForcing = 0;
+    magStaticForcing = 0;
+    momTimeForcing = 0;
+    magTimeForcing = 0;
+    kinematic = 0;
+    recentering = NOCENTERING;
+    sanitize = 0;
+
+    int configFlags[NFLAGS];
+    for(i = 0; i < NFLAGS; i++)
+        configFlags[i] = *setTargets[i];
+
+    for(i = 0; i < ngrids; i++)
+    {
+        for(j = 0; j < ndecomps; j++)
+        {
+            nx = grids[i][0];
+            ny = grids[i][1];
+            nz = grids[i][2];
+            hdiv = decomps[j][0];
+            vdiv = decomps[j][1];
+
+            //Every processor needs at least one of each distributed index
+            lab_initGeometry();
+            if(hdiv < 1 || vdiv < 1 || hdiv * vdiv + n_io_nodes > gsize)
+            {
+                warn("Skipping %dx%d on a %dx%dx%d grid: needs %d processors and there are %d\n", hdiv, vdiv, nx, ny, nz, hdiv * vdiv + n_io_nodes, gsize);
+                continue;
+            }
+            if(hdiv > nx || hdiv > ndky || vdiv > nz || vdiv > ndkx)
+            {
+                warn("Skipping %dx%d on a %dx%dx%d grid: too many processors for the grid\n", hdiv, vdiv, nx, ny, nz);
+                continue;
+            }
+
+            setupEnvironment();
+            initState();
+            if(compute_node)
+                initPhysics();
+
+            for(k = 0; k < nffts; k++)
+            {
+                if(compute_node)
+                    com_select(ffts[k]);
+
+                for(l = 0; l < nsets; l++)
+                {
+                    int f;
+                    for(f = 0; f < NFLAGS; f++)
+                        *setTargets[f] = (sets[l] ? setFlags[sets[l]][f] : configFlags[f]);
+
+                    if(!compute_node)
+                        continue;
+
+                    benchCase c;
+                    c.nx = nx;
+                    c.ny = ny;
+                    c.nz = nz;
+                    c.hdiv = hdiv;
+                    c.vdiv = vdiv;
+                    c.set = sets[l];
+                    c.fft = ffts[k];
+                    timeCase(&c);
+
+                    if(grank == 0)
+                    {
+                        fprintf(stderr, "%dx%dx%d on %dx%d, fft%d, %s: transform %g s, step %g s\n", nx, ny, nz, hdiv, vdiv, c.fft, setNames[c.set], c.fftTime, c.stepTime);
+                        cases = (benchCase*)realloc(cases, (ncases + 1) * sizeof(benchCase));
+                        cases[ncases++] = c;
+                    }
+                }
+            }
+
+            if(compute_node)
+            {
+                finalizePhysics();
+                finalizeState();
+                com_finalize();
+            }
+            lab_finalize();
+
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+
+    if(grank == 0)
+    {
+        scaling();
+        writeResults();
+        free(cases);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    return 0;
+}
+
+/*
+ * Breaks a list from the configuration file into its entries, which may be
+ * separated by spaces, tabs or commas.  The list is modified in place.
+ */
+int splitList(char * list, char ** entries)
+{
+    int n = 0;
+    char * tok = strtok(list, " ,\t\r\n");
+    while(tok && n < MAX_LIST)
+    {
+        entries[n++] = tok;
+        tok = strtok(0, " ,\t\r\n");
+    }
+    return n;
+}
+
+/*
+ * Times one case on the compute nodes.  The state is all zeros and nothing is
+ * forcing it, so it stays that way and every case does the same work no
+ * matter how long the benchmark runs.  The slowest node decides the times.
+ */
+void timeCase(benchCase * c)
+{
+    int i;
+    double start;
+
+    MPI_Barrier(ccomm);
+    start = MPI_Wtime();
+    for(i = 0; i < benchRepeats; i++)
+    {
+        fftForward(u->vec->x);
+        fftBackward(u->vec->x);
+    }
+    c->fftTime = (MPI_Wtime() - start) / benchRepeats;
+
+    //Start the integration over so the warmup covers the lower order steps
+    iteration = 0;
+    elapsedTime = 0;
+    dt = 0;
+    dt1 = 0;
+    dt2 = 0;
+    for(i = 0; i < benchWarmup + benchSteps; i++)
+    {
+        if(i == benchWarmup)
+        {
+            MPI_Barrier(ccomm);
+            start = MPI_Wtime();
+        }
+        iteration++;
+        iterate();
+    }
+    c->stepTime = (MPI_Wtime() - start) / benchSteps;
+
+    MPI_Allreduce(MPI_IN_PLACE, &c->fftTime, 1, MPI_DOUBLE, MPI_MAX, ccomm);
+    MPI_Allreduce(MPI_IN_PLACE, &c->stepTime, 1, MPI_DOUBLE, MPI_MAX, ccomm);
+}
+
+/*
+ * Scaling efficiencies are relative to the case with the fewest processors
+ * running the same physics and FFT routine.  For strong scaling that case has
+ * the same grid, and efficiency is T1 P1 / (T P).  For weak scaling it has the
+ * same number of grid points per processor, and efficiency is T1 / T.  A case
+ * with nothing to compare against has an efficiency of 1.
+ */
+void scaling()
+{
+    int i,j;
+
+    for(i = 0; i < ncases; i++)
+    {
+        benchCase * c = &cases[i];
+        benchCase * strong = c;
+        benchCase * weak = c;
+        long long ranks = c->hdiv * c->vdiv;
+        long long points = (long long)c->nx * c->ny * c->nz;
+
+        for(j = 0; j < ncases; j++)
+        {
+            benchCase * o = &cases[j];
+            long long oranks = o->hdiv * o->vdiv;
+            long long opoints = (long long)o->nx * o->ny * o->nz;
+
+            if(o->set != c->set || o->fft != c->fft)
+                continue;
+
+            if(o->nx == c->nx && o->ny == c->ny && o->nz == c->nz && oranks < strong->hdiv * strong->vdiv)
+                strong = o;
+            if(opoints * ranks == points * oranks && oranks < weak->hdiv * weak->vdiv)
+                weak = o;
+        }
+
+        double sranks = strong->hdiv * strong->vdiv;
+        c->fftStrong = strong->fftTime * sranks / (c->fftTime * ranks);
+        c->stepStrong = strong->stepTime * sranks / (c->stepTime * ranks);
+        c->fftWeak = weak->fftTime / c->fftTime;
+        c->stepWeak = weak->stepTime / c->stepTime;
+    }
+}
+
+void writeResults()
+{
+    int i;
+    char base[200];
+    char name[220];
+    FILE * out;
+
+    #ifdef FP
+    const char * precision = "float";
+    #else
+    const char * precision = "double";
+    #endif
+
+    if(!benchOutput || sscanf(benchOutput, "%199s", base) != 1)
+        strcpy(base, "benchmark");
+
+    sprintf(name, "%s.csv", base);
+    out = fopen(name, "w");
+    if(!out)
+    {
+        error("Could not open %s for the benchmark results\n", name);
+        return;
+    }
+    fprintf(out, "nx,ny,nz,hdiv,vdiv,ranks,threads,precision,physics,fft,fft_time,step_time,fft_strong,step_strong,fft_weak,step_weak\n");
+    for(i = 0; i < ncases; i++)
+    {
+        benchCase * c = &cases[i];
+        fprintf(out, "%d,%d,%d,%d,%d,%d,%d,%s,%s,%d,%.6e,%.6e,%.4f,%.4f,%.4f,%.4f\n",
+                c->nx, c->ny, c->nz, c->hdiv, c->vdiv, c->hdiv * c->vdiv, nthreads, precision, setNames[c->set], c->fft,
+                c->fftTime, c->stepTime, c->fftStrong, c->stepStrong, c->fftWeak, c->stepWeak);
+    }
+    fclose(out);
+
+    sprintf(name, "%s.json", base);
+    out = fopen(name, "w");
+    if(!out)
+    {
+        error("Could not open %s for the benchmark results\n", name);
+        return;
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"precision\": \"%s\",\n", precision);
+    fprintf(out, "  \"threads\": %d,\n", nthreads);
+    fprintf(out, "  \"floatTranspose\": %d,\n", floatTranspose);
+    fprintf(out, "  \"steps\": %d,\n", benchSteps);
+    fprintf(out, "  \"warmup\": %d,\n", benchWarmup);
+    fprintf(out, "  \"repeats\": %d,\n", benchRepeats);
+    fprintf(out, "  \"cases\": [\n");
+    for(i = 0; i < ncases; i++)
+    {
+        benchCase * c = &cases[i];
+        fprintf(out, "    {\"nx\": %d, \"ny\": %d, \"nz\": %d, \"hdiv\": %d, \"vdiv\": %d, \"ranks\": %d, \"physics\": \"%s\", \"fft\": %d, ",
+                c->nx, c->ny, c->nz, c->hdiv, c->vdiv, c->hdiv * c->vdiv, setNames[c->set], c->fft);
+        fprintf(out, "\"fft_time\": %.6e, \"step_time\": %.6e, \"fft_strong\": %.4f, \"step_strong\": %.4f, \"fft_weak\": %.4f, \"step_weak\": %.4f}%s\n",
+                c->fftTime, c->stepTime, c->fftStrong, c->stepStrong, c->fftWeak, c->stepWeak, (i < ncases - 1 ? "," : ""));
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+
+    info("Benchmark results written to %s.csv and %s.json\n", base, base);
+}
+
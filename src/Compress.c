@@ -0,0 +1,325 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Compress.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//The LZ stage.  Matches are found through a hash of the next 4 bytes, and
+//can reach back at most 64KB since offsets are stored in two bytes.
+#define CMP_HASH_BITS 14
+#define CMP_MIN_MATCH 4
+#define CMP_MAX_OFFSET 65535
+
+//Quantized values have to stay well inside what a double holds exactly, so
+//that the differences between them do too.
+#define CMP_MAX_QUANT 4.5e15
+
+static int cmp_lz(unsigned char * in, int n, unsigned char * out, int cap);
+static int cmp_unlz(unsigned char * in, int len, unsigned char * out, int n);
+static int cmp_emit(unsigned char * lit, int nlit, int offset, int mlen, unsigned char * out, int op, int cap);
+static int cmp_length(int len, unsigned char * out, int op);
+static void cmp_shuffle(unsigned char * in, int n, int size, unsigned char * out);
+static void cmp_unshuffle(unsigned char * in, int n, int size, unsigned char * out);
+
+int cmp_bound(int n)
+{
+    return 1 + n * sizeof(PRECISION);
+}
+
+int cmp_pack(PRECISION * in, int n, PRECISION tol, unsigned char * out)
+{
+    int i;
+    int raw = n * sizeof(PRECISION);
+    int len = -1;
+
+    //room for the quantized values and a shuffled copy of them
+    unsigned char * work = (unsigned char *)malloc(2 * n * sizeof(unsigned long long));
+    unsigned char * shuffled = work + n * sizeof(unsigned long long);
+
+    if(tol > 0)
+    {
+        unsigned long long * zz = (unsigned long long *)work;
+        double scale = 1.0 / (2.0 * tol);
+        long long prev = 0;
+
+        //differences between neighbouring multiples of 2*tol, zigzag encoded
+        //so small negative differences have small codes too
+        for(i = 0; i < n; i++)
+        {
+            double v = in[i] * scale;
+            if(!(fabs(v) < CMP_MAX_QUANT))
+                break;
+            long long q = (long long)floor(v + 0.5);
+            long long d = q - prev;
+            prev = q;
+            zz[i] = ((unsigned long long)d << 1) ^ (unsigned long long)(d >> 63);
+        }
+
+        if(i == n)
+        {
+            cmp_shuffle(work, n, sizeof(unsigned long long), shuffled);
+            len = cmp_lz(shuffled, n * sizeof(unsigned long long), out + 1, raw);
+            out[0] = CMP_QUANT;
+        }
+    }
+
+    if(len < 0)
+    {
+        cmp_shuffle((unsigned char *)in, n, sizeof(PRECISION), shuffled);
+        len = cmp_lz(shuffled, raw, out + 1, raw);
+        out[0] = CMP_SHUFFLE;
+    }
+
+    if(len < 0)
+    {
+        memcpy(out + 1, in, raw);
+        len = raw;
+        out[0] = CMP_RAW;
+    }
+
+    free(work);
+    return len + 1;
+}
+
+int cmp_unpack(unsigned char * in, int len, int n, PRECISION tol, PRECISION * out)
+{
+    int i;
+    int raw = n * sizeof(PRECISION);
+    int status = 0;
+
+    if(len < 1)
+        return -1;
+
+    if(in[0] == CMP_RAW)
+    {
+        if(len - 1 != raw)
+            return -1;
+        memcpy(out, in + 1, raw);
+        return 0;
+    }
+
+    unsigned char * work = (unsigned char *)malloc(2 * n * sizeof(unsigned long long));
+    unsigned char * shuffled = work + n * sizeof(unsigned long long);
+
+    if(in[0] == CMP_SHUFFLE)
+    {
+        status = cmp_unlz(in + 1, len - 1, shuffled, raw);
+        if(status == 0)
+            cmp_unshuffle(shuffled, n, sizeof(PRECISION), (unsigned char *)out);
+    }
+    else if(in[0] == CMP_QUANT && tol > 0)
+    {
+        unsigned long long * zz = (unsigned long long *)work;
+        double step = 2.0 * tol;
+        long long q = 0;
+
+        status = cmp_unlz(in + 1, len - 1, shuffled, n * sizeof(unsigned long long));
+        if(status == 0)
+        {
+            cmp_unshuffle(shuffled, n, sizeof(unsigned long long), work);
+            for(i = 0; i < n; i++)
+            {
+                q += (long long)(zz[i] >> 1) ^ -(long long)(zz[i] & 1);
+                out[i] = q * step;
+            }
+        }
+    }
+    else
+    {
+        status = -1;
+    }
+
+    free(work);
+    return status;
+}
+
+/*
+ * Compresses n bytes into out, giving up and returning -1 if that would take
+ * more than cap bytes.  The output is a list of sequences, each a run of 
+ * literal bytes followed by a copy of earlier output:
+ * 
+ *   token       high 4 bits literal count, low 4 bits match length - 4, with
+ *               15 meaning more follows as bytes of 255 and a final remainder
+ *   literals
+ *   offset      2 bytes, little endian, back from the current position
+ *   match length extension, if any
+ * 
+ * The last sequence stops after its literals.
+ */
+static int cmp_lz(unsigned char * in, int n, unsigned char * out, int cap)
+{
+    int table[1 << CMP_HASH_BITS];
+    int i;
+    int anchor = 0;
+    int op = 0;
+
+    for(i = 0; i < (1 << CMP_HASH_BITS); i++)
+        table[i] = -1;
+
+    i = 0;
+    while(i + CMP_MIN_MATCH <= n)
+    {
+        unsigned int seq;
+        memcpy(&seq, in + i, sizeof(seq));
+        unsigned int h = (seq * 2654435761u) >> (32 - CMP_HASH_BITS);
+        int ref = table[h];
+        table[h] = i;
+
+        if(ref < 0 || i - ref > CMP_MAX_OFFSET || memcmp(in + ref, in + i, CMP_MIN_MATCH) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        int mlen = CMP_MIN_MATCH;
+        while(i + mlen < n && in[ref + mlen] == in[i + mlen])
+            mlen++;
+
+        op = cmp_emit(in + anchor, i - anchor, i - ref, mlen, out, op, cap);
+        if(op < 0)
+            return -1;
+        i += mlen;
+        anchor = i;
+    }
+
+    return cmp_emit(in + anchor, n - anchor, 0, 0, out, op, cap);
+}
+
+static int cmp_emit(unsigned char * lit, int nlit, int offset, int mlen, unsigned char * out, int op, int cap)
+{
+    int m = mlen ? mlen - CMP_MIN_MATCH : 0;
+
+    //the most this sequence could take
+    if(op + 1 + nlit + nlit / 255 + 1 + 2 + m / 255 + 1 > cap)
+        return -1;
+
+    out[op++] = ((nlit < 15 ? nlit : 15) << 4) | (m < 15 ? m : 15);
+    op = cmp_length(nlit, out, op);
+    memcpy(out + op, lit, nlit);
+    op += nlit;
+
+    if(mlen)
+    {
+        out[op++] = offset & 255;
+        out[op++] = offset >> 8;
+        op = cmp_length(m, out, op);
+    }
+
+    return op;
+}
+
+static int cmp_length(int len, unsigned char * out, int op)
+{
+    if(len < 15)
+        return op;
+
+    len -= 15;
+    while(len >= 255)
+    {
+        out[op++] = 255;
+        len -= 255;
+    }
+    out[op++] = len;
+
+    return op;
+}
+
+/*
+ * Inverse of cmp_lz.  Fails unless the input decodes to exactly n bytes.
+ */
+static int cmp_unlz(unsigned char * in, int len, unsigned char * out, int n)
+{
+    int i;
+    int ip = 0;
+    int op = 0;
+    int b;
+
+    while(ip < len)
+    {
+        int token = in[ip++];
+
+        int nlit = token >> 4;
+        if(nlit == 15)
+        {
+            do
+            {
+                if(ip >= len)
+                    return -1;
+                b = in[ip++];
+                nlit += b;
+            }while(b == 255);
+        }
+        if(ip + nlit > len || op + nlit > n)
+            return -1;
+        memcpy(out + op, in + ip, nlit);
+        ip += nlit;
+        op += nlit;
+
+        if(ip == len)
+            break;
+
+        if(ip + 2 > len)
+            return -1;
+        int offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+
+        int mlen = token & 15;
+        if(mlen == 15)
+        {
+            do
+            {
+                if(ip >= len)
+                    return -1;
+                b = in[ip++];
+                mlen += b;
+            }while(b == 255);
+        }
+        mlen += CMP_MIN_MATCH;
+        if(offset == 0 || offset > op || op + mlen > n)
+            return -1;
+
+        //byte at a time, since a match may overlap what it is copying
+        for(i = 0; i < mlen; i++)
+            out[op + i] = out[op - offset + i];
+        op += mlen;
+    }
+
+    return op == n ? 0 : -1;
+}
+
+static void cmp_shuffle(unsigned char * in, int n, int size, unsigned char * out)
+{
+    int i,b;
+
+    for(b = 0; b < size; b++)
+        for(i = 0; i < n; i++)
+            out[b * n + i] = in[i * size + b];
+}
+
+static void cmp_unshuffle(unsigned char * in, int n, int size, unsigned char * out)
+{
+    int i,b;
+
+    for(b = 0; b < size; b++)
+        for(i = 0; i < n; i++)
+            out[i * size + b] = in[b * n + i];
+}
@@ -0,0 +1,343 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Diagnostics.h"
+#include "Environment.h"
+#include "State.h"
+#include "Log.h"
+
+#include <mpi.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Points handled per block.  Every source for a block has to fit in cache
+//alongside the arrays being read.
+#define DIAG_BLOCK 512
+#define DIAG_MAX_SOURCES 16
+#define DIAG_MAX_COUNT 64
+
+typedef struct
+{
+    p_field field;      //read in place if set
+    diag_fill fill;     //otherwise computed into a block buffer
+}diagSource;
+
+typedef struct
+{
+    const char * name;
+    int source;
+    int op;
+}diagnostic;
+
+diagSource diagSources[DIAG_MAX_SOURCES];
+int nDiagSources = 0;
+diagnostic diagnostics[DIAG_MAX_COUNT];
+int nDiagnostics = 0;
+
+//The whole record is a single element of diagType, so MPI can never hand the
+//reduction a piece of one.  It is rebuilt whenever the record has grown.
+MPI_Datatype diagType;
+int diagTypeCount = 0;
+MPI_Op diagOp;
+
+void diag_combine(void * in, void * inout, int * len, MPI_Datatype * type);
+void diag_kinetic(int start, int count, PRECISION * out);
+void diag_magnetic(int start, int count, PRECISION * out);
+
+/*
+ * The standard diagnostics.  Scalars records start with the iteration and the
+ * elapsed time, and then hold these in order:
+ *
+ * [2]  --  min  u
+ * [3]  --  max  u
+ * [4]  --  mean u
+ * [5]  --  min  v
+ * [6]  --  max  v
+ * [7]  --  mean v
+ * [8]  --  min  w
+ * [9]  --  max  w
+ * [10] --  mean w
+ * [11] --  mean kinetic energy density
+ * [12] --  max kinetic energy density
+ *
+ * ------------ Only present if magnetic fields are included:
+ * [13] --  min  Bx
+ * [14] --  max  Bx
+ * [15] --  mean Bx
+ * [16] --  min  By
+ * [17] --  max  By
+ * [18] --  mean By
+ * [19] --  min  Bz
+ * [20] --  max  Bz
+ * [21] --  mean Bz
+ * [22] --  mean magnetic energy density
+ * [23] --  max  magnetic energy density
+ *
+ * Note the energy densities are summed, not averaged, to match what has always
+ * been written.
+ */
+void diag_init()
+{
+    int src;
+
+    nDiagSources = 0;
+    nDiagnostics = 0;
+
+    src = diag_addField(u->vec->x);
+    diag_add("min u", src, DIAG_MIN);
+    diag_add("max u", src, DIAG_MAX);
+    diag_add("mean u", src, DIAG_MEAN);
+    src = diag_addField(u->vec->y);
+    diag_add("min v", src, DIAG_MIN);
+    diag_add("max v", src, DIAG_MAX);
+    diag_add("mean v", src, DIAG_MEAN);
+    src = diag_addField(u->vec->z);
+    diag_add("min w", src, DIAG_MIN);
+    diag_add("max w", src, DIAG_MAX);
+    diag_add("mean w", src, DIAG_MEAN);
+    src = diag_addSource(diag_kinetic);
+    diag_add("kinetic energy", src, DIAG_SUM);
+    diag_add("max kinetic energy density", src, DIAG_MAX);
+
+    if(magEquation)
+    {
+        src = diag_addField(B->vec->x);
+        diag_add("min Bx", src, DIAG_MIN);
+        diag_add("max Bx", src, DIAG_MAX);
+        diag_add("mean Bx", src, DIAG_MEAN);
+        src = diag_addField(B->vec->y);
+        diag_add("min By", src, DIAG_MIN);
+        diag_add("max By", src, DIAG_MAX);
+        diag_add("mean By", src, DIAG_MEAN);
+        src = diag_addField(B->vec->z);
+        diag_add("min Bz", src, DIAG_MIN);
+        diag_add("max Bz", src, DIAG_MAX);
+        diag_add("mean Bz", src, DIAG_MEAN);
+        src = diag_addSource(diag_magnetic);
+        diag_add("magnetic energy", src, DIAG_SUM);
+        diag_add("max magnetic energy density", src, DIAG_MAX);
+    }
+
+    MPI_Op_create(diag_combine, 1, &diagOp);
+}
+
+void diag_finalize()
+{
+    if(diagTypeCount)
+        MPI_Type_free(&diagType);
+    diagTypeCount = 0;
+    MPI_Op_free(&diagOp);
+}
+
+int diag_addField(p_field f)
+{
+    if(nDiagSources == DIAG_MAX_SOURCES)
+    {
+        error("Too many diagnostic sources registered!  The code will now crash gracelessly\n");
+        abort();
+    }
+
+    diagSources[nDiagSources].field = f;
+    diagSources[nDiagSources].fill = 0;
+    return nDiagSources++;
+}
+
+int diag_addSource(diag_fill fill)
+{
+    if(nDiagSources == DIAG_MAX_SOURCES)
+    {
+        error("Too many diagnostic sources registered!  The code will now crash gracelessly\n");
+        abort();
+    }
+
+    diagSources[nDiagSources].field = 0;
+    diagSources[nDiagSources].fill = fill;
+    return nDiagSources++;
+}
+
+void diag_add(const char * name, int source, int op)
+{
+    if(nDiagnostics == DIAG_MAX_COUNT)
+    {
+        error("Too many diagnostics registered!  %s will not be computed\n", name);
+        return;
+    }
+
+    diagnostics[nDiagnostics].name = name;
+    diagnostics[nDiagnostics].source = source;
+    diagnostics[nDiagnostics].op = op;
+    nDiagnostics++;
+}
+
+int diag_count()
+{
+    return nDiagnostics;
+}
+
+const char * diag_name(int i)
+{
+    return diagnostics[i].name;
+}
+
+/*
+ * The reduction itself.  Everything here is pointwise within a block, with no
+ * calls and no branches in the inner loops, so the compiler is free to
+ * vectorize them.  Sums are kept in order so the results do not depend on the
+ * block size.
+ */
+void diag_compute(PRECISION * out)
+{
+    int i,d,s;
+    int start;
+    PRECISION * local = (PRECISION*)malloc(nDiagnostics * sizeof(PRECISION));
+    PRECISION * blocks = (PRECISION*)malloc(nDiagSources * DIAG_BLOCK * sizeof(PRECISION));
+    PRECISION * values[DIAG_MAX_SOURCES];
+
+    if(diagTypeCount != nDiagnostics)
+    {
+        if(diagTypeCount)
+            MPI_Type_free(&diagType);
+        MPI_Type_contiguous(nDiagnostics, MPI_PRECISION, &diagType);
+        MPI_Type_commit(&diagType);
+        diagTypeCount = nDiagnostics;
+    }
+
+    for(d = 0; d < nDiagnostics; d++)
+    {
+        if(diagnostics[d].op == DIAG_MIN)
+            local[d] = INFINITY;
+        else if(diagnostics[d].op == DIAG_MAX)
+            local[d] = -INFINITY;
+        else
+            local[d] = 0;
+    }
+
+    for(start = 0; start < spatialCount; start += DIAG_BLOCK)
+    {
+        int count = (spatialCount - start < DIAG_BLOCK ? spatialCount - start : DIAG_BLOCK);
+
+        for(s = 0; s < nDiagSources; s++)
+        {
+            if(diagSources[s].field)
+            {
+                values[s] = diagSources[s].field->spatial + start;
+            }
+            else
+            {
+                values[s] = blocks + s * DIAG_BLOCK;
+                diagSources[s].fill(start, count, values[s]);
+            }
+        }
+
+        for(d = 0; d < nDiagnostics; d++)
+        {
+            const PRECISION * v = values[diagnostics[d].source];
+            PRECISION acc = local[d];
+
+            if(diagnostics[d].op == DIAG_MIN)
+            {
+                for(i = 0; i < count; i++)
+                    acc = (v[i] < acc ? v[i] : acc);
+            }
+            else if(diagnostics[d].op == DIAG_MAX)
+            {
+                for(i = 0; i < count; i++)
+                    acc = (v[i] > acc ? v[i] : acc);
+            }
+            else
+            {
+                for(i = 0; i < count; i++)
+                    acc += v[i];
+            }
+
+            local[d] = acc;
+        }
+    }
+
+    MPI_Reduce(local, out, 1, diagType, diagOp, 0, ccomm);
+
+    if(crank == 0)
+    {
+        for(d = 0; d < nDiagnostics; d++)
+        {
+            if(diagnostics[d].op == DIAG_MEAN)
+                out[d] /= (nx*ny*nz);
+        }
+    }
+
+    free(local);
+    free(blocks);
+}
+
+/*
+ * MPI_Op for a whole record of diagType.  Each entry combines according to the
+ * operation it was registered with.
+ */
+void diag_combine(void * in, void * inout, int * len, MPI_Datatype * type)
+{
+    int i,d;
+    PRECISION * a = (PRECISION*)in;
+    PRECISION * b = (PRECISION*)inout;
+
+    //A record built for a different number of diagnostics would be walked
+    //with the wrong stride
+    if(*type != diagType)
+    {
+        error("Diagnostic reduction applied to the wrong datatype!  The code will now crash gracelessly\n");
+        abort();
+    }
+
+    for(i = 0; i < *len; i++)
+    {
+        for(d = 0; d < nDiagnostics; d++)
+        {
+            if(diagnostics[d].op == DIAG_MIN)
+                b[d] = fmin(a[d], b[d]);
+            else if(diagnostics[d].op == DIAG_MAX)
+                b[d] = fmax(a[d], b[d]);
+            else
+                b[d] += a[d];
+        }
+        a += nDiagnostics;
+        b += nDiagnostics;
+    }
+}
+
+void diag_kinetic(int start, int count, PRECISION * out)
+{
+    int i;
+    const PRECISION * x = u->vec->x->spatial + start;
+    const PRECISION * y = u->vec->y->spatial + start;
+    const PRECISION * z = u->vec->z->spatial + start;
+
+    for(i = 0; i < count; i++)
+        out[i] = x[i]*x[i] + y[i]*y[i] + z[i]*z[i];
+}
+
+void diag_magnetic(int start, int count, PRECISION * out)
+{
+    int i;
+    const PRECISION * x = B->vec->x->spatial + start;
+    const PRECISION * y = B->vec->y->spatial + start;
+    const PRECISION * z = B->vec->z->spatial + start;
+
+    for(i = 0; i < count; i++)
+        out[i] = x[i]*x[i] + y[i]*y[i] + z[i]*z[i];
+}
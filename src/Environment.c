@@ -22,10 +22,14 @@
 #include "Communication.h"
 #include "Log.h"
 #include "Properties.h"
+#include "Numerics.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /*
  * Here we take care of initialization things.  Namely, we set the variables
@@ -38,6 +42,9 @@ void setupEnvironment()
 {
     PI = 4.0 * atan2(1.0, 1.0);
 
+    if(autoDecomp)
+        lab_chooseLayout();
+
     if(n_io_nodes > gsize - hdiv*vdiv)
     {
         error("ERROR!  Too many io nodes requested!  n_io_nodes = %d.  The code will now crash gracelessly\n", n_io_nodes);
@@ -47,10 +54,43 @@ void setupEnvironment()
     iteration = 0;
     elapsedTime = 0;
 
+    //Crank-Nicolson is only set up for the AB steps.  The integrating factor
+    //is just as stable, and works with every integrator.
+    if(integrator != INTEGRATE_AB3 && diffusionMethod == DIFFUSE_IMPLICIT)
+    {
+        warn("Implicit diffusion needs the AB3 integrator.  Integrating diffusion exactly instead\n");
+        diffusionMethod = DIFFUSE_EXACT;
+    }
+
+    //Threads are only used between MPI calls, so the main thread must be the
+    //one doing all the communication, and MPI has to be fine with that
+    if(nthreads > 1)
+    {
+        int provided;
+        MPI_Query_thread(&provided);
+        #ifdef _OPENMP
+        if(provided < MPI_THREAD_FUNNELED)
+        {
+            warn("MPI does not support threads.  Running with 1 thread instead of %d\n", nthreads);
+            nthreads = 1;
+        }
+        #else
+        warn("Not compiled with OpenMP.  Running with 1 thread instead of %d\n", nthreads);
+        nthreads = 1;
+        #endif
+    }
+    if(nthreads < 1)
+        nthreads = 1;
+    #ifdef _OPENMP
+    omp_set_num_threads(nthreads);
+    #endif
+    info("Running with %d threads per process\n", nthreads);
+
     //Check out LaborDivision.c for most of the initialization code.
     lab_initGeometry();
     lab_initGroups();
     lab_initDistributions();
+    lab_reportTraffic();
 
     if(grank == 0)
     {
@@ -64,6 +104,7 @@ void setupEnvironment()
     //parameter!
     if(compute_node)
     {
+        initWavenumbers();
         com_init(0);
     }
 
@@ -80,8 +121,15 @@ MPI_Comm fcomm;
 
 int hdiv;
 int vdiv;
+int autoDecomp = 0;
+int autoTrial = 0;
+int nodePlacement = 0;
 int compute_node;
 int io_node;
+int nthreads = 1;
+int fftWisdom = 0;
+int fftPatient = 0;
+int floatTranspose = 0;
 
 int grank = -1;
 int gsize = -1;
@@ -129,6 +177,11 @@ indexes * max_ky;
 indexes dealias_kz;
 int spatialCount;
 int spectralCount;
+PRECISION * kxTable = 0;
+PRECISION * kyTable = 0;
+PRECISION * kzTable = 0;
+PRECISION * kh2Inv = 0;
+PRECISION * k2Inv = 0;
 
 indexes * io_layers;
 int my_io_layer;
@@ -146,6 +199,14 @@ int scalarRate = 1000;
 int scalarPerF = 1;
 int checkRate = 1000;
 int checkDir = 0;
+int spatialCompression = COMPRESS_OFF;
+PRECISION uTol = 0;
+PRECISION vTol = 0;
+PRECISION wTol = 0;
+PRECISION TTol = 0;
+PRECISION BxTol = 0;
+PRECISION ByTol = 0;
+PRECISION BzTol = 0;
 
 int momEquation = 0;
 int magEquation = 0;
@@ -160,6 +221,7 @@ int tempAdvection = 0;
 int tempBackground = 1; //this controls an if statement nested in an if reliant on the tempAdvection flag.  We want to default them to act together, as this is the norm.
 int magDiff = 0;
 int magAdvect = 0;
+int nonlinearForm = NONLINEAR_DIVERGENCE;
 
 //forcing terms
 int momStaticForcing = 0;
@@ -190,12 +252,23 @@ int maxSteps = 0;
 PRECISION maxTime = 0;
 int iteration = 0;
 PRECISION safetyFactor = 0;
+int diffusionMethod = DIFFUSE_EXPLICIT;
+int integrator = INTEGRATE_AB3;
+int historyStart = 0;
 PRECISION dt = 0;
 PRECISION dt1 = 0;
 PRECISION dt2 = 0;
 PRECISION elapsedTime = 0;
 
-char infostro[] = "Time: %g\n";
+char * benchDecomps = 0;
+char * benchGrids = 0;
+char * benchPhysics = 0;
+char * benchFFTs = 0;
+int benchSteps = 10;
+int benchWarmup = 3;
+int benchRepeats = 20;
+char * benchOutput = 0;
+
 #ifdef FP
 char infostri[] = "Time: %f\n";
 #else
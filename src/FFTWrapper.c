@@ -18,6 +18,7 @@
  */
 
 #include "FFTWrapper.h"
+#include "Profile.h"
 
 
 FFT_PLAN fft_plan_r2c(int rank, const int *n, int howmany,
@@ -84,28 +85,99 @@ void fft_free(void * data)
 
 void fft_execute_r2c(FFT_PLAN plan, PRECISION * in, FFT_COMPLEX * out)
 {
+    prof_start(PROF_FFT);
     #ifdef FP
     fftwf_execute_dft_r2c(plan, in, out);
     #else
     fftw_execute_dft_r2c(plan, in, out);
     #endif
+    prof_stop(PROF_FFT);
 }
 
 void fft_execute_c2c(FFT_PLAN plan, FFT_COMPLEX * in, FFT_COMPLEX * out)
 {
+    prof_start(PROF_FFT);
     #ifdef FP
     fftwf_execute_dft(plan, in, out);
     #else
     fftw_execute_dft(plan, in, out);
     #endif
+    prof_stop(PROF_FFT);
 }
 
 void fft_execute_c2r(FFT_PLAN plan, FFT_COMPLEX * in, PRECISION * out)
 {
+    prof_start(PROF_FFT);
     #ifdef FP
     fftwf_execute_dft_c2r(plan, in, out);
     #else
     fftw_execute_dft_c2r(plan, in, out);
     #endif
+    prof_stop(PROF_FFT);
+}
+
+void fft_destroy_plan(FFT_PLAN plan)
+{
+    #ifdef FP
+    fftwf_destroy_plan(plan);
+    #else
+    fftw_destroy_plan(plan);
+    #endif
+}
+
+int fft_import_wisdom(const char * filename)
+{
+    #ifdef FP
+    return fftwf_import_wisdom_from_filename(filename);
+    #else
+    return fftw_import_wisdom_from_filename(filename);
+    #endif
+}
+
+int fft_export_wisdom(const char * filename)
+{
+    #ifdef FP
+    return fftwf_export_wisdom_to_filename(filename);
+    #else
+    return fftw_export_wisdom_to_filename(filename);
+    #endif
+}
+
+/*
+ * The threaded FFTW routines live in a separate library that is only linked
+ * in when building with OpenMP.  Without it these quietly do nothing, and all
+ * plans are single threaded.
+ */
+void fft_init_threads()
+{
+    #ifdef _OPENMP
+    #ifdef FP
+    fftwf_init_threads();
+    #else
+    fftw_init_threads();
+    #endif
+    #endif
+}
+
+void fft_plan_with_nthreads(int nthreads)
+{
+    #ifdef _OPENMP
+    #ifdef FP
+    fftwf_plan_with_nthreads(nthreads);
+    #else
+    fftw_plan_with_nthreads(nthreads);
+    #endif
+    #endif
+}
+
+void fft_cleanup_threads()
+{
+    #ifdef _OPENMP
+    #ifdef FP
+    fftwf_cleanup_threads();
+    #else
+    fftw_cleanup_threads();
+    #endif
+    #endif
 }
 
@@ -34,11 +34,17 @@ void allocateSpatial(p_field f)
     f->spatial = (PRECISION*)fft_malloc(my_x->width * my_z->width * ny * sizeof(PRECISION));
 }
 
+/*
+ * AB3 needs the last three forces.  The Runge-Kutta integrators only need the
+ * current force and a register in force2, so they go without force3.
+ */
 void allocateForce(p_field f)
 {
     f->force1 = (complex PRECISION*)fft_malloc(spectralCount * sizeof(complex PRECISION));
     f->force2 = (complex PRECISION*)fft_malloc(spectralCount * sizeof(complex PRECISION));
-    f->force3 = (complex PRECISION*)fft_malloc(spectralCount * sizeof(complex PRECISION));
+    f->force3 = 0;
+    if(integrator == INTEGRATE_AB3)
+        f->force3 = (complex PRECISION*)fft_malloc(spectralCount * sizeof(complex PRECISION));
 }
 
 void eraseSpatial(p_field f)
@@ -104,8 +110,13 @@ p_solenoid newSolenoid()
    ret->mean_yf1 = (complex PRECISION*)malloc(ndkz * sizeof(complex PRECISION));
    ret->mean_xf2 = (complex PRECISION*)malloc(ndkz * sizeof(complex PRECISION));
    ret->mean_yf2 = (complex PRECISION*)malloc(ndkz * sizeof(complex PRECISION));
-   ret->mean_xf3 = (complex PRECISION*)malloc(ndkz * sizeof(complex PRECISION));
-   ret->mean_yf3 = (complex PRECISION*)malloc(ndkz * sizeof(complex PRECISION));
+   ret->mean_xf3 = 0;
+   ret->mean_yf3 = 0;
+   if(integrator == INTEGRATE_AB3)
+   {
+       ret->mean_xf3 = (complex PRECISION*)malloc(ndkz * sizeof(complex PRECISION));
+       ret->mean_yf3 = (complex PRECISION*)malloc(ndkz * sizeof(complex PRECISION));
+   }
 
    return ret;
 }
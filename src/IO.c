@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <math.h>
 
 #include "IO.h"
@@ -30,14 +31,90 @@
 #include "State.h"
 #include "Numerics.h"
 #include "Communication.h"
+#include "Profile.h"
+#include "Diagnostics.h"
+#include "Compress.h"
 
 FILE * status = 0;
 
 int scalarCount;
 PRECISION * scalarData;
 PRECISION * piScalarData;
+char * scalarNames;
 int numScalar;
 
+/*
+ * Spatial dumps and checkpoints from performOutput are asynchronous.  Compute
+ * nodes copy their data into one of two staging buffers and post non-blocking
+ * sends to their IO node, which sits in ioService() doing the reshuffle and
+ * file write while the compute nodes carry on.  A compute node only waits if
+ * it comes back to a staging buffer whose sends from two dumps ago have not
+ * gone out yet.  Each dump is announced by a header from the root compute
+ * node holding the kind of dump, iteration, elapsedTime, dt, dt1 and checkDir.
+ */
+#define IO_MAX_SPATIAL 7
+
+//Spatial dumps and Scalars files start with a header, see io_fileHeader
+#define IO_MAGIC "PROTEUS"
+#define IO_FILE_SPATIAL 1
+#define IO_FILE_SCALARS 2
+#define IO_FILE_VERSION 1
+#define IO_FILE_INTS 32
+#define IO_FILE_REALS 16
+#define IO_FILE_HEAD (8 + IO_FILE_INTS * sizeof(int) + IO_FILE_REALS * sizeof(double))
+#define IO_NAME 32
+
+#define IO_MAX_BYTES (1 << 30)
+#define IO_HEAD_SIZE 6
+#define IO_DUMP_STOP 0
+#define IO_DUMP_SPATIAL 1
+#define IO_DUMP_CHECK 2
+#define IO_TAG_HEAD 1
+#define IO_TAG_MEAN 2
+#define IO_TAG_CHECK 3
+#define IO_TAG_DATA 4
+
+int numSpatial;
+PRECISION * stage[2];
+MPI_Request * stageReq[2];
+double stageHead[2][IO_HEAD_SIZE];
+int stageNext;
+
+int numCheck;
+int numMean;
+complex PRECISION * checkStage[2];
+MPI_Request checkReq[2][3];
+double checkHead[2][IO_HEAD_SIZE];
+int checkNext;
+
+static void io_layerCounts(int * counts, int * displs);
+static void io_reshuffle(PRECISION * rcvbuff, PRECISION * sndbuff);
+static MPI_Offset io_openDump(MPI_File * fh, char * name, int count);
+static void io_writeChunk(MPI_File fh, MPI_Offset * end, PRECISION * sndbuff, PRECISION tol, long long * entry);
+static void io_closeDump(MPI_File * fh, int count, char ** names, PRECISION * tols, long long * table);
+static int io_fieldEntry(int chunks);
+static void io_chunks(int * chunks);
+static void io_fileHeader(unsigned char * head, int kind, int count, int chunks);
+static void io_writeAtAll(MPI_File fh, MPI_Offset offset, unsigned char * buff, long long len);
+static void io_readAt(MPI_File fh, MPI_Offset offset, unsigned char * buff, long long len);
+static void io_readFile(PRECISION * sndbuff, char * name, char * fieldName);
+static int io_spatialFields(p_field * fields, char ** names, PRECISION * tols);
+static void io_postSpatial();
+static void io_postHead(double * head, int kind, MPI_Request * req);
+static void io_serveSpatial(PRECISION * rcvbuff, PRECISION * sndbuff);
+static void io_serveCheck(double * head, complex PRECISION * rcvbuff, complex PRECISION * sndbuff);
+
+/*
+ * A checkpoint holds at most two solenoidal fields of 13 arrays each, and the
+ * temperature with its two forcing evaluations.
+ */
+#define IO_CHECK_HEADER 8
+#define IO_MAX_CHECK 29
+
+static int io_checkArrays(complex PRECISION ** arrays, int * lengths);
+static void io_checkHeader(int * header);
+static void io_checkTypes(MPI_Datatype * ctype, MPI_Datatype * block, MPI_Offset * disp);
+
 /*
  * This is a very rudimentary test routine to ensure that we can write data
  * to disk and read it back in without corruption.  We just create three simple
@@ -150,7 +227,9 @@ void testIO()
  *      all the IO nodes will now result in a well ordered layout.
  * 
  * 3.   The set of all IO nodes perform a parallel write to disk, resulting in
- *      a single file with an expected ordering.
+ *      a single file with an expected ordering.  If compression is turned on
+ *      each z plane is compressed on its IO node and the file starts with an
+ *      index of where every plane landed instead.
  * 
  *      Note:  The reason compute nodes store data as [z][x][y] instead of 
  *             [z][y][x] is so that after an FFT operation (and it's required
@@ -163,10 +242,8 @@ void testIO()
  */
 void writeSpatial(field * f, char * name)
 {
-    int i,j,k,l,m;
     debug("Writing spatial data to file %s\n", name);
 
-    int sndcnt = 0;
     PRECISION * rcvbuff = 0;
     PRECISION * sndbuff = 0;
     
@@ -179,7 +256,7 @@ void writeSpatial(field * f, char * name)
     debug("consolidating data to IO nodes\n");
     if(compute_node)
     {
-        sndcnt = my_x->width * my_z->width * ny;
+        int sndcnt = my_x->width * my_z->width * ny;
         trace("Sending %d PRECISIONs\n", sndcnt);
         MPI_Gatherv(f->spatial, sndcnt, MPI_PRECISION, 0, 0, 0, MPI_PRECISION, 0, iocomm);
         debug("Write Spatial completed\n");
@@ -191,37 +268,69 @@ void writeSpatial(field * f, char * name)
         sndbuff = (PRECISION *)malloc(nx * ny * nz_layers * sizeof(PRECISION));
         trace("Total local data will be %d PRECISIONs\n", nx*ny*nz_layers);
 
-        //We need to calculate the starting index that data from each compute
-        //processor will begin at in our array.
-        //Note:  Since our own IO node is not contributing any data, both our
-        //       IO node and the first compute node get to start at a 
-        //       displacement of 0.
-        displs[0] = 0;
-        displs[1] = 0;
-        rcvcounts[0] = 0;
+        io_layerCounts(rcvcounts, displs);
+        MPI_Gatherv(0, 0, MPI_PRECISION, rcvbuff, rcvcounts, displs, MPI_PRECISION, 0, iocomm);
+    }
 
-        //staggered loop.  We calculate how much data we receive from one
-        //processor at the same time we calculate where the data for the
-        //next processor will begin storage.
-        int * pidspls = displs + 2;
-        int * pircvcounts = rcvcounts+1;
-        for(i = io_layers[my_io_layer].min; i <= io_layers[my_io_layer].max; i++)
+    io_reshuffle(rcvbuff, sndbuff);
+
+    //the file holds just this one field, named after the file
+    char * base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+    PRECISION tol = 0;
+    long long table[2 * n_io_nodes];
+    MPI_File fh;
+    MPI_Offset end = io_openDump(&fh, name, 1);
+    io_writeChunk(fh, &end, sndbuff, tol, table);
+    io_closeDump(&fh, 1, &base, &tol, table);
+
+    free(sndbuff);
+    free(rcvbuff);
+
+    debug("Write Spatial completed\n");
+
+}
+
+/*
+ * Works out how much data each member of our IO group contributes to a
+ * spatial field, and where it lands in the gathered array.  The IO node
+ * itself contributes nothing, so both it and the first compute node start at
+ * a displacement of 0.
+ */
+static void io_layerCounts(int * counts, int * displs)
+{
+    int i,j;
+
+    displs[0] = 0;
+    displs[1] = 0;
+    counts[0] = 0;
+
+    //staggered loop.  We calculate how much data we receive from one
+    //processor at the same time we calculate where the data for the
+    //next processor will begin storage.
+    int * pidspls = displs + 2;
+    int * picounts = counts + 1;
+    for(i = io_layers[my_io_layer].min; i <= io_layers[my_io_layer].max; i++)
+    {
+        for(j = 0; j < hdiv; j++)
         {
-            for(j = 0; j < hdiv; j++)
-            {
-                *pircvcounts = all_x[j].width * all_z[i].width * ny;
-                *pidspls = *(pidspls-1) + *pircvcounts;
-                trace("Proc %d should send %d PRECISIONs at displacement %d\n", hdiv * i + j, *pircvcounts, *pidspls);
-                pidspls++;
-                pircvcounts++;
-            }
+            *picounts = all_x[j].width * all_z[i].width * ny;
+            *pidspls = *(pidspls-1) + *picounts;
+            trace("Proc %d should send %d PRECISIONs at displacement %d\n", hdiv * i + j, *picounts, *pidspls);
+            pidspls++;
+            picounts++;
         }
-        MPI_Gatherv(0, 0, MPI_PRECISION, rcvbuff, rcvcounts, displs, MPI_PRECISION, 0, iocomm);
     }
+}
+
+/*
+ * Stage 2 of writeSpatial, the transpose from [l][h][vz][hx][y] as gathered
+ * to [lz][y][x] as it will sit in the file.
+ */
+static void io_reshuffle(PRECISION * rcvbuff, PRECISION * sndbuff)
+{
+    int i,j,k,l,m;
 
     debug("transposing data so it is properly contiguous\n");
-    //rcvbuff is [l][h][vz][hx][y]
-    //we want [lz][y][x]
     int indexr = 0;
     int indexs = 0;
     for(i = 0; i < io_layers[my_io_layer].width; i++)
@@ -247,42 +356,371 @@ void writeSpatial(field * f, char * name)
             }
         }
     }
+}
+
+/*
+ * Stage 3 of writeSpatial.  All the fields of a dump go into a single file,
+ * laid out as
+ * 
+ * 1.   The IO_FILE_HEAD byte header filled in by io_fileHeader.
+ * 2.   The z chunks, as a pair of ints per IO node: the first plane and the
+ *      number of planes that IO node held when the dump was written.
+ * 3.   For each field, an IO_NAME character name and its compression 
+ *      tolerance as a double, followed by the long long byte offset and
+ *      length of each of its chunks.
+ * 4.   The chunks.  An uncompressed chunk is just its planes of the field as
+ *      [z][y][x], so any part of it can be read, or mapped, straight out of
+ *      the file.  A compressed chunk starts with depth + 1 long long offsets,
+ *      from the start of the chunk, to each plane as packed by cmp_pack and to
+ *      the end of the last one.
+ * 
+ * io_openDump returns where the first chunk goes, each IO node then writes its
+ * own chunk of one field after another with io_writeChunk, and io_closeDump 
+ * fills in the header and tables.  All three are collective over fcomm.  The
+ * tolerance of a field is the largest error allowed when compressing it, and
+ * 0 keeps it lossless.
+ */
+static MPI_Offset io_openDump(MPI_File * fh, char * name, int count)
+{
+    debug("Opening %s for %d fields\n", name, count);
+    MPI_File_open(fcomm, name, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, fh);
+    MPI_File_set_size(*fh, 0);
 
+    return IO_FILE_HEAD + 2 * n_io_nodes * sizeof(int) + (MPI_Offset)count * io_fieldEntry(n_io_nodes);
+}
 
+static void io_writeChunk(MPI_File fh, MPI_Offset * end, PRECISION * sndbuff, PRECISION tol, long long * entry)
+{
+    int i;
+    int plane = nx * ny;
+    long long mine;
+    long long sizes[n_io_nodes];
+    unsigned char * chunk;
 
-    debug("Performing parallel file write\n");
-    //TODO: revisit MPI_MODE_SEQUENTIAL and MPI_INFO_NULL to make sure these are what we want
-    MPI_File fh;
-    MPI_File_open(fcomm, name, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
-    debug("MPI File opened successfully\n");
-    
-    //Calculate displacements for each IO processor into the full file.
-    int disp = 0;
-    
-    //loop over each IO processor before us
-    for(i = 0; i < my_io_layer; i++)
+    if(spatialCompression == COMPRESS_OFF)
+    {
+        chunk = (unsigned char *)sndbuff;
+        mine = (long long)nz_layers * plane * sizeof(PRECISION);
+    }
+    else
+    {
+        debug("Compressing %d planes with tolerance %g\n", nz_layers, tol);
+        chunk = (unsigned char *)malloc((nz_layers + 1) * sizeof(long long) + (size_t)nz_layers * cmp_bound(plane));
+        long long * index = (long long *)chunk;
+        mine = (nz_layers + 1) * sizeof(long long);
+        for(i = 0; i < nz_layers; i++)
+        {
+            index[i] = mine;
+            mine += cmp_pack(sndbuff + i * plane, plane, tol, chunk + mine);
+        }
+        index[nz_layers] = mine;
+        trace("Packed %d planes into %lld bytes\n", nz_layers, mine);
+    }
+
+    //every IO node works out where every chunk goes, so any of them could
+    //write the table
+    MPI_Allgather(&mine, 1, MPI_LONG_LONG, sizes, 1, MPI_LONG_LONG, fcomm);
+    for(i = 0; i < n_io_nodes; i++)
+    {
+        entry[2 * i] = *end;
+        entry[2 * i + 1] = sizes[i];
+        *end += sizes[i];
+    }
+
+    io_writeAtAll(fh, entry[2 * my_io_layer], chunk, mine);
+
+    if(spatialCompression != COMPRESS_OFF)
+        free(chunk);
+}
+
+static void io_closeDump(MPI_File * fh, int count, char ** names, PRECISION * tols, long long * table)
+{
+    int i;
+    int entry = io_fieldEntry(n_io_nodes);
+    int len = IO_FILE_HEAD + 2 * n_io_nodes * sizeof(int) + count * entry;
+    int chunks[2 * n_io_nodes];
+    unsigned char * head = (unsigned char *)calloc(len, 1);
+    unsigned char * p = head + IO_FILE_HEAD;
+
+    io_fileHeader(head, IO_FILE_SPATIAL, count, n_io_nodes);
+    io_chunks(chunks);
+    memcpy(p, chunks, sizeof(chunks));
+    p += sizeof(chunks);
+    for(i = 0; i < count; i++)
+    {
+        double tol = tols[i];
+        strncpy((char *)p, names[i], IO_NAME - 1);
+        memcpy(p + IO_NAME, &tol, sizeof(double));
+        memcpy(p + IO_NAME + sizeof(double), table + 2 * n_io_nodes * i, 2 * n_io_nodes * sizeof(long long));
+        p += entry;
+    }
+
+    MPI_File_write_at_all(*fh, 0, head, frank == 0 ? len : 0, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(fh);
+    free(head);
+}
+
+/*
+ * The bytes a field takes up in the table of a dump with the given number of
+ * chunks.
+ */
+static int io_fieldEntry(int chunks)
+{
+    return IO_NAME + sizeof(double) + 2 * chunks * sizeof(long long);
+}
+
+/*
+ * The z chunks of a dump written by this run, as the first plane and number
+ * of planes held by each IO node.
+ */
+static void io_chunks(int * chunks)
+{
+    int i,j;
+    int first = 0;
+
+    for(i = 0; i < n_io_nodes; i++)
     {
-        //calculate how many layers those IO processors contribute
+        int depth = 0;
         for(j = io_layers[i].min; j <= io_layers[i].max; j++)
         {
-            disp += all_z[j].width;
+            depth += all_z[j].width;
         }
+        chunks[2 * i] = first;
+        chunks[2 * i + 1] = depth;
+        first += depth;
     }
-    //Convert layers into actual data size.
-    disp *= nx * ny * sizeof(PRECISION);
-    
-    trace("Our view starts at element %d\n", disp);
-    trace("Setting view...\n");
-    MPI_File_set_view(fh, disp, MPI_PRECISION, MPI_PRECISION, "native", MPI_INFO_NULL);
-    trace("Writing to file...\n");
-    MPI_File_write(fh, sndbuff, nx * ny * nz_layers, MPI_PRECISION, MPI_STATUS_IGNORE );
-    MPI_File_close(&fh);
+}
 
-    free(sndbuff);
-    free(rcvbuff);
+/*
+ * Spatial dumps and Scalars files start with an IO_FILE_HEAD byte header
+ * describing the run that wrote them:
+ * 
+ *   char   magic[8]    IO_MAGIC
+ *   int    ints[32]    the kind of file (IO_FILE_SPATIAL or IO_FILE_SCALARS),
+ *                      IO_FILE_VERSION, 0x01020304 to tell the byte order,
+ *                      sizeof(PRECISION), nx, ny, nz, hdiv, vdiv, n_io_nodes,
+ *                      iteration, count, chunks, the compression mode, and 
+ *                      then the momEquation, magEquation, tEquation,
+ *                      kinematic, momAdvection, viscosity, buoyancy, magBuoy,
+ *                      lorentz, tDiff, tempAdvection, tempBackground, magDiff,
+ *                      magAdvect, momStaticForcing, magStaticForcing,
+ *                      momTimeForcing and magTimeForcing flags
+ *   double reals[16]   elapsedTime, dt, xmx, ymx, zmx, Pr, Ra, Pm, alpha,
+ *                      magBuoyScale, momOmega, momEps, magK, magW, magB0 and
+ *                      one spare
+ * 
+ * For a spatial dump count is the number of fields and chunks the number of z
+ * chunks, see io_openDump for the rest of the file.  For a Scalars file they
+ * are the number of scalars per record and the number of records, and the
+ * header is followed by an IO_NAME character name for each scalar and then
+ * the records themselves.
+ */
+static void io_fileHeader(unsigned char * head, int kind, int count, int chunks)
+{
+    int ints[IO_FILE_INTS] = {kind, IO_FILE_VERSION, 0x01020304, sizeof(PRECISION),
+        nx, ny, nz, hdiv, vdiv, n_io_nodes, iteration, count, chunks,
+        kind == IO_FILE_SPATIAL ? spatialCompression : COMPRESS_OFF,
+        momEquation, magEquation, tEquation, kinematic, momAdvection, viscosity,
+        buoyancy, magBuoy, lorentz, tDiff, tempAdvection, tempBackground,
+        magDiff, magAdvect, momStaticForcing, magStaticForcing, momTimeForcing,
+        magTimeForcing};
+    double reals[IO_FILE_REALS] = {elapsedTime, dt, xmx, ymx, zmx, Pr, Ra, Pm,
+        alpha, magBuoyScale, momOmega, momEps, magK, magW, magB0, 0};
+
+    memset(head, 0, IO_FILE_HEAD);
+    memcpy(head, IO_MAGIC, 8);
+    memcpy(head + 8, ints, sizeof(ints));
+    memcpy(head + 8 + sizeof(ints), reals, sizeof(reals));
+}
 
-    debug("Write Spatial completed\n");
+/*
+ * Collective write of len bytes at offset.  MPI counts are ints, so big 
+ * transfers go in pieces, with every IO node making the same number of calls.
+ */
+static void io_writeAtAll(MPI_File fh, MPI_Offset offset, unsigned char * buff, long long len)
+{
+    long long rounds = (len + IO_MAX_BYTES - 1) / IO_MAX_BYTES;
+    long long i;
+
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_LONG_LONG, MPI_MAX, fcomm);
+    for(i = 0; i < rounds; i++)
+    {
+        long long done = i * IO_MAX_BYTES;
+        int count = len - done > IO_MAX_BYTES ? IO_MAX_BYTES : (len > done ? len - done : 0);
+        MPI_File_write_at_all(fh, offset + done, buff + done, count, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+}
+
+/*
+ * Independent read of len bytes at offset, in pieces MPI can count.
+ */
+static void io_readAt(MPI_File fh, MPI_Offset offset, unsigned char * buff, long long len)
+{
+    long long done;
 
+    for(done = 0; done < len; done += IO_MAX_BYTES)
+    {
+        int count = len - done > IO_MAX_BYTES ? IO_MAX_BYTES : len - done;
+        MPI_File_read_at(fh, offset + done, buff + done, count, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+}
+
+/*
+ * The file half of readSpatial.  Fills sndbuff with our planes of the field as
+ * [lz][y][x].  A dump may have been written with any number of IO nodes, so
+ * we read whatever part of each of its chunks overlaps our planes.  
+ * fieldName picks a field out of the dump, or the first one if it is 0.  Files
+ * without a header are taken to be a bare [z][y][x] array of the field, which
+ * is how dumps used to be written and how forcing files are made.
+ */
+static void io_readFile(PRECISION * sndbuff, char * name, char * fieldName)
+{
+    int i,c;
+    int plane = nx * ny;
+    int mine[2 * n_io_nodes];
+    unsigned char head[IO_FILE_HEAD];
+    MPI_Offset size;
+    MPI_File fh;
+
+    io_chunks(mine);
+    int first = mine[2 * my_io_layer];
+
+    //TODO: revisit MPI_MODE_SEQUENTIAL and MPI_INFO_NULL to make sure these are what we want
+    debug("Reading file\n");
+    if(MPI_File_open(fcomm, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        error("Failed to open %s!  Crashing gracelessly...\n", name);
+        abort();
+    }
+
+    MPI_File_get_size(fh, &size);
+    memset(head, 0, IO_FILE_HEAD);
+    if(size >= (MPI_Offset)IO_FILE_HEAD)
+        io_readAt(fh, 0, head, IO_FILE_HEAD);
+
+    if(memcmp(head, IO_MAGIC, 8) != 0)
+    {
+        MPI_Offset disp = (MPI_Offset)first * plane * sizeof(PRECISION);
+        trace("Our file view starts at displacement %lld\n", (long long)disp);
+        trace("Setting view\n");
+        MPI_File_set_view(fh, disp, MPI_PRECISION, MPI_PRECISION, "native", MPI_INFO_NULL);
+        trace("Reading file\n");
+        MPI_File_read(fh, sndbuff, plane * nz_layers, MPI_PRECISION, MPI_STATUS_IGNORE );
+        MPI_File_close(&fh);
+        return;
+    }
+
+    int ints[IO_FILE_INTS];
+    memcpy(ints, head + 8, sizeof(ints));
+    if(ints[2] != 0x01020304)
+    {
+        error("%s was written on a machine with a different byte order\n", name);
+        abort();
+    }
+    if(ints[0] != IO_FILE_SPATIAL || ints[1] > IO_FILE_VERSION)
+    {
+        error("%s is not a spatial dump this version can read\n", name);
+        abort();
+    }
+    if(ints[4] != nx || ints[5] != ny || ints[6] != nz || ints[3] != sizeof(PRECISION))
+    {
+        error("%s holds a %dx%dx%d grid of %d byte reals, not what this run uses\n", name, ints[4], ints[5], ints[6], ints[3]);
+        abort();
+    }
+    int count = ints[11];
+    int nchunks = ints[12];
+    int mode = ints[13];
+
+    //the chunk map and field table
+    int entry = io_fieldEntry(nchunks);
+    int len = 2 * nchunks * sizeof(int) + count * entry;
+    unsigned char * table = (unsigned char *)malloc(len);
+    io_readAt(fh, IO_FILE_HEAD, table, len);
+
+    int theirs[2 * nchunks];
+    memcpy(theirs, table, sizeof(theirs));
+    for(i = 0; i < count; i++)
+    {
+        if(fieldName == 0 || strncmp((char *)table + sizeof(theirs) + i * entry, fieldName, IO_NAME) == 0)
+            break;
+    }
+    if(i == count)
+    {
+        error("%s has no field called %s\n", name, fieldName);
+        abort();
+    }
+
+    double tol;
+    long long where[2 * nchunks];
+    memcpy(&tol, table + sizeof(theirs) + i * entry + IO_NAME, sizeof(double));
+    memcpy(where, table + sizeof(theirs) + i * entry + IO_NAME + sizeof(double), sizeof(where));
+    free(table);
+    debug("Reading %s from %d chunks with compression mode %d\n", fieldName ? fieldName : "the first field", nchunks, mode);
+
+    for(c = 0; c < nchunks; c++)
+    {
+        //the planes of this chunk that are also ours
+        int lo = theirs[2 * c] > first ? theirs[2 * c] : first;
+        int hi = theirs[2 * c] + theirs[2 * c + 1];
+        if(hi > first + nz_layers)
+            hi = first + nz_layers;
+        if(lo >= hi)
+            continue;
+
+        PRECISION * out = sndbuff + (lo - first) * plane;
+        MPI_Offset start = where[2 * c];
+        if(mode == COMPRESS_OFF)
+        {
+            io_readAt(fh, start + (MPI_Offset)(lo - theirs[2 * c]) * plane * sizeof(PRECISION), (unsigned char *)out, (long long)(hi - lo) * plane * sizeof(PRECISION));
+        }
+        else
+        {
+            long long index[hi - lo + 1];
+            io_readAt(fh, start + (lo - theirs[2 * c]) * sizeof(long long), (unsigned char *)index, sizeof(index));
+
+            long long bytes = index[hi - lo] - index[0];
+            unsigned char * packed = (unsigned char *)malloc(bytes + 1);
+            io_readAt(fh, start + index[0], packed, bytes);
+            for(i = 0; i < hi - lo; i++)
+            {
+                if(cmp_unpack(packed + index[i] - index[0], index[i + 1] - index[i], plane, tol, out + i * plane))
+                {
+                    error("Plane %d of %s in %s is corrupt!\n", lo + i, fieldName ? fieldName : "the first field", name);
+                    abort();
+                }
+            }
+            free(packed);
+        }
+    }
+
+    MPI_File_close(&fh);
+}
+
+/*
+ * Only needs the header, so any one process can call this by itself.
+ */
+int spatialDumpInfo(char * name, int * iter, PRECISION * time)
+{
+    unsigned char head[IO_FILE_HEAD];
+    int ints[IO_FILE_INTS];
+    double reals[IO_FILE_REALS];
+
+    FILE * in = fopen(name, "r");
+    if(!in)
+        return 0;
+    int got = fread(head, 1, IO_FILE_HEAD, in);
+    fclose(in);
+
+    if(got != IO_FILE_HEAD || memcmp(head, IO_MAGIC, 8) != 0)
+        return 0;
+    memcpy(ints, head + 8, sizeof(ints));
+    memcpy(reals, head + 8 + sizeof(ints), sizeof(reals));
+    if(ints[0] != IO_FILE_SPATIAL)
+        return 0;
+
+    *iter = ints[10];
+    *time = reals[0];
+    return 1;
 }
 
 /*
@@ -290,6 +728,11 @@ void writeSpatial(field * f, char * name)
  * function.
  */
 void readSpatial(field * f, char * name)
+{
+    readSpatialField(f, name, 0);
+}
+
+void readSpatialField(field * f, char * name, char * fieldName)
 {
     int i,j,k,l,m;
     debug("Reading spatial data from file %s\n", name);
@@ -303,29 +746,7 @@ void readSpatial(field * f, char * name)
         rcvbuff = (PRECISION *)malloc(nx * ny * nz_layers * sizeof(PRECISION));
         trace("Total local data will be %d PRECISIONs\n", nx*ny*nz_layers);
 
-        //do a mpi IO operation
-        //TODO: revisit MPI_MODE_SEQUENTIAL and MPI_INFO_NULL to make sure these are what we want
-        MPI_File fh;
-        debug("Reading file\n");
-        MPI_File_open(fcomm, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
-
-        int disp = 0;
-        for(i = 0; i < my_io_layer; i++)
-        {
-            for(j = io_layers[i].min; j <= io_layers[i].max; j++)
-            {
-                disp += all_z[j].width;
-            }
-        }
-        disp *= nx * ny * sizeof(PRECISION);
-        trace("Our file view starts at displacement %d\n", disp);
-        trace("Setting view\n");
-        MPI_File_set_view(fh, disp, MPI_PRECISION, MPI_PRECISION, "native", MPI_INFO_NULL);
-        trace("Reading file\n");
-        MPI_File_read(fh, sndbuff, nx * ny * nz_layers, MPI_PRECISION, MPI_STATUS_IGNORE );
-
-        MPI_File_close(&fh);
-    
+        io_readFile(sndbuff, name, fieldName);
 
         debug("transposing the data for scatter to compute nodes\n");
         //rcvbuff is [l][h][vz][hx][y]
@@ -401,20 +822,47 @@ void readSpatial(field * f, char * name)
 /*
  * There really are only two things we need to initialize.
  * 
- * 1.   How many scalars there will be, which depends on if magnetic fields
- *      are included in the calculation or not.
+ * 1.   How many scalars there will be, which is the iteration and elapsed time
+ *      followed by whatever diagnostics are registered in Diagnostics.c.
  * 2.   Set up the array that will hold the scalar values between outputs to
  *      disk.
+ * 
+ * Compute nodes also get the two staging buffers each for asynchronous 
+ * spatial dumps and checkpoints, big enough to hold one whole dump.
  */
 void initIO()
 {
-    if(magEquation)
-    {
-        numScalar = 24;
-    }
-    else
+    int i,j;
+    p_field fields[IO_MAX_SPATIAL];
+    char * names[IO_MAX_SPATIAL];
+    PRECISION tols[IO_MAX_SPATIAL];
+
+    numSpatial = io_spatialFields(fields, names, tols);
+
+    //IO nodes have no arrays to hand to io_checkArrays, so this has to agree
+    //with it by hand
+    int nsols = (momEquation != 0) + (magEquation != 0);
+    numCheck = 6 * nsols + 3 * (tEquation != 0);
+    numMean = nsols * (6 * ndkz + 1);
+
+    if(compute_node)
     {
-        numScalar = 13;
+        diag_init();
+        numScalar = 2 + diag_count();
+
+        for(i = 0; i < 2; i++)
+        {
+            stage[i] = (PRECISION *)malloc(numSpatial * spatialCount * sizeof(PRECISION));
+            stageReq[i] = (MPI_Request *)malloc((numSpatial + 1) * sizeof(MPI_Request));
+            for(j = 0; j <= numSpatial; j++)
+                stageReq[i][j] = MPI_REQUEST_NULL;
+
+            checkStage[i] = (complex PRECISION *)malloc((numCheck * spectralCount + numMean) * sizeof(complex PRECISION));
+            for(j = 0; j < 3; j++)
+                checkReq[i][j] = MPI_REQUEST_NULL;
+        }
+        stageNext = 0;
+        checkNext = 0;
     }
 
     if(crank == 0)
@@ -432,6 +880,13 @@ void initIO()
             fclose(status);
         }
 
+        //what each entry of a scalar record is, for the Scalars files
+        scalarNames = (char *)calloc(numScalar, IO_NAME);
+        strcpy(scalarNames, "iteration");
+        strcpy(scalarNames + IO_NAME, "elapsed time");
+        for(i = 0; i < diag_count(); i++)
+            strncpy(scalarNames + (i + 2) * IO_NAME, diag_name(i), IO_NAME - 1);
+
         scalarCount = 0;
 
         scalarData = malloc(numScalar * scalarPerF * sizeof(PRECISION));
@@ -444,10 +899,334 @@ void initIO()
  */
 void finalizeIO()
 {
+    int i;
+
     if(crank == 0)
     {
         free(scalarData);
+        free(scalarNames);
+    }
+    if(compute_node)
+    {
+        diag_finalize();
+
+        //let the last dumps drain, then tell our IO node to stop serving
+        for(i = 0; i < 2; i++)
+        {
+            MPI_Waitall(numSpatial + 1, stageReq[i], MPI_STATUSES_IGNORE);
+            MPI_Waitall(3, checkReq[i], MPI_STATUSES_IGNORE);
+            free(stage[i]);
+            free(stageReq[i]);
+            free(checkStage[i]);
+        }
+
+        double head[IO_HEAD_SIZE];
+        MPI_Request req;
+        io_postHead(head, IO_DUMP_STOP, &req);
+        MPI_Wait(&req, MPI_STATUS_IGNORE);
+    }
+}
+
+/*
+ * The fields making up a spatial dump, in the order they are sent, along with
+ * the file each one is written to and its tolerance for lossy compression.
+ * Only compute nodes get field pointers.
+ */
+static int io_spatialFields(p_field * fields, char ** names, PRECISION * tols)
+{
+    int n = 0;
+
+    if(momEquation || kinematic)
+    {
+        fields[n] = compute_node ? u->vec->x : 0;
+        tols[n] = uTol;
+        names[n++] = "u";
+        fields[n] = compute_node ? u->vec->y : 0;
+        tols[n] = vTol;
+        names[n++] = "v";
+        fields[n] = compute_node ? u->vec->z : 0;
+        tols[n] = wTol;
+        names[n++] = "w";
+    }
+    if(tEquation)
+    {
+        fields[n] = compute_node ? T : 0;
+        tols[n] = TTol;
+        names[n++] = "T";
+    }
+    if(magEquation)
+    {
+        fields[n] = compute_node ? B->vec->x : 0;
+        tols[n] = BxTol;
+        names[n++] = "Bx";
+        fields[n] = compute_node ? B->vec->y : 0;
+        tols[n] = ByTol;
+        names[n++] = "By";
+        fields[n] = compute_node ? B->vec->z : 0;
+        tols[n] = BzTol;
+        names[n++] = "Bz";
+    }
+
+    return n;
+}
+
+/*
+ * Compute node half of a spatial dump.  The fields are copied into the next
+ * staging buffer and sent off without waiting, with the root compute node also
+ * sending the iteration and time the dump belongs to.
+ */
+static void io_postSpatial()
+{
+    int i;
+    p_field fields[IO_MAX_SPATIAL];
+    char * names[IO_MAX_SPATIAL];
+    PRECISION tols[IO_MAX_SPATIAL];
+    int b = stageNext;
+
+    //This only blocks if our IO node is still busy with the dump before last
+    MPI_Waitall(numSpatial + 1, stageReq[b], MPI_STATUSES_IGNORE);
+
+    io_spatialFields(fields, names, tols);
+    for(i = 0; i < numSpatial; i++)
+    {
+        trace("Staging %s\n", names[i]);
+        memcpy(stage[b] + i * spatialCount, fields[i]->spatial, spatialCount * sizeof(PRECISION));
+        MPI_Isend(stage[b] + i * spatialCount, spatialCount, MPI_PRECISION, 0, IO_TAG_DATA + i, iocomm, stageReq[b] + i);
+    }
+    io_postHead(stageHead[b], IO_DUMP_SPATIAL, stageReq[b] + numSpatial);
+
+    stageNext = 1 - b;
+}
+
+/*
+ * The root compute node announces each dump to the first IO node, which
+ * passes it on to the rest since an IO node need not have any compute nodes
+ * of its own.  The header has to stay put until req completes.
+ */
+static void io_postHead(double * head, int kind, MPI_Request * req)
+{
+    *req = MPI_REQUEST_NULL;
+    if(crank == 0)
+    {
+        head[0] = kind;
+        head[1] = iteration;
+        head[2] = elapsedTime;
+        head[3] = dt;
+        head[4] = dt1;
+        head[5] = checkDir;
+        MPI_Isend(head, IO_HEAD_SIZE, MPI_DOUBLE, 0, IO_TAG_HEAD, iocomm, req);
+    }
+}
+
+/*
+ * IO nodes call this instead of iterating.  We wait for the header of the next
+ * dump, which the root compute node sends to the first IO node to pass on to
+ * the rest, and then receive and write out whatever it announces.  The compute
+ * nodes are free to run ahead while we write, and their next dump simply waits
+ * in their staging buffers until we come back around.  Dumps are handled 
+ * strictly in order, so one checkpoint is committed before the next one
+ * starts overwriting the other directory.
+ */
+void ioService()
+{
+    int i;
+    double head[IO_HEAD_SIZE];
+
+    //our IO group holds a contiguous slab of kx for every spectral array
+    int slab = 0;
+    for(i = io_layers[my_io_layer].min; i <= io_layers[my_io_layer].max; i++)
+        slab += all_kx[i].width;
+
+    int layerSize = nx * ny * nz_layers;
+    int slabSize = slab * ndky * ndkz;
+    PRECISION * rcvbuff = (PRECISION *)malloc(numSpatial * layerSize * sizeof(PRECISION));
+    PRECISION * sndbuff = (PRECISION *)malloc(layerSize * sizeof(PRECISION));
+    complex PRECISION * checkRcv = (complex PRECISION *)malloc((numCheck * slabSize + numMean) * sizeof(complex PRECISION));
+    complex PRECISION * checkSnd = (complex PRECISION *)malloc(slabSize * sizeof(complex PRECISION));
+
+    while(1)
+    {
+        if(frank == 0)
+            MPI_Recv(head, IO_HEAD_SIZE, MPI_DOUBLE, 1, IO_TAG_HEAD, iocomm, MPI_STATUS_IGNORE);
+        MPI_Bcast(head, IO_HEAD_SIZE, MPI_DOUBLE, 0, fcomm);
+        if(head[0] == IO_DUMP_STOP)
+            break;
+        iteration = head[1];
+        elapsedTime = head[2];
+        dt = head[3];
+
+        if(head[0] == IO_DUMP_SPATIAL)
+            io_serveSpatial(rcvbuff, sndbuff);
+        else
+            io_serveCheck(head, checkRcv, checkSnd);
+    }
+
+    free(checkSnd);
+    free(checkRcv);
+    free(sndbuff);
+    free(rcvbuff);
+    debug("IO service done\n");
+}
+
+/*
+ * IO node half of a spatial dump.  We receive every field from every compute
+ * node in our group, and then reshuffle and write each one just as 
+ * writeSpatial does.
+ */
+static void io_serveSpatial(PRECISION * rcvbuff, PRECISION * sndbuff)
+{
+    int i,j;
+    char name[100];
+    p_field fields[IO_MAX_SPATIAL];
+    char * names[IO_MAX_SPATIAL];
+    PRECISION tols[IO_MAX_SPATIAL];
+    int displs[iosize+1];
+    int counts[iosize];
+    MPI_Request req[numSpatial * iosize];
+    long long table[2 * n_io_nodes * numSpatial];
+    int layerSize = nx * ny * nz_layers;
+
+    io_spatialFields(fields, names, tols);
+    io_layerCounts(counts, displs);
+    debug("Receiving spatial dump for iteration %d\n", iteration);
+
+    for(i = 0; i < numSpatial; i++)
+    {
+        req[i * iosize] = MPI_REQUEST_NULL;
+        for(j = 1; j < iosize; j++)
+            MPI_Irecv(rcvbuff + i * layerSize + displs[j], counts[j], MPI_PRECISION, j, IO_TAG_DATA + i, iocomm, req + i * iosize + j);
+    }
+
+    //the tolerances only mean something for lossy compression
+    for(i = 0; i < numSpatial; i++)
+    {
+        if(spatialCompression != COMPRESS_LOSSY)
+            tols[i] = 0;
+    }
+
+    //open the file while the data comes in
+    sprintf(name, "Spatial/%08d", iteration);
+    MPI_File fh;
+    MPI_Offset end = io_openDump(&fh, name, numSpatial);
+
+    MPI_Waitall(numSpatial * iosize, req, MPI_STATUSES_IGNORE);
+    for(i = 0; i < numSpatial; i++)
+    {
+        trace("Writing %s to %s\n", names[i], name);
+        io_reshuffle(rcvbuff + i * layerSize, sndbuff);
+        io_writeChunk(fh, &end, sndbuff, tols[i], table + 2 * n_io_nodes * i);
+    }
+    io_closeDump(&fh, numSpatial, names, tols, table);
+}
+
+/*
+ * IO node half of a checkpoint.  Each compute node in our group sends all of
+ * its spectral arrays back to back, and the root also sends the mean flows.
+ * For every array we reshuffle the [v][h][kx][ky][kz] blocks into our slab of
+ * the global [kx][ky][kz] array and write it where writeCheckpoint's layout
+ * says it goes.  Only once the file is synced do we write the state file that
+ * makes the checkpoint the one to restart from.
+ */
+static void io_serveCheck(double * head, complex PRECISION * rcvbuff, complex PRECISION * sndbuff)
+{
+    int i,j,k,l,m,a;
+    char name[100];
+    int header[IO_CHECK_HEADER];
+    int counts[iosize];
+    int displs[iosize];
+    MPI_Request req[iosize + 1];
+    MPI_File fh;
+    int dir = head[5];
+    int first = io_layers[my_io_layer].min;
+    int last = io_layers[my_io_layer].max;
+    int sz = sizeof(complex PRECISION);
+
+    debug("Receiving checkpoint for iteration %d\n", iteration);
+
+    //how much each compute node holds, in iocomm order
+    int total = 0;
+    int slab = 0;
+    counts[0] = 0;
+    displs[0] = 0;
+    for(i = first; i <= last; i++)
+    {
+        for(j = 0; j < hdiv; j++)
+        {
+            k = 1 + (i - first) * hdiv + j;
+            counts[k] = all_kx[i].width * all_ky[j].width * ndkz;
+            displs[k] = total;
+            total += numCheck * counts[k];
+        }
+        slab += all_kx[i].width;
+    }
+    int kx0 = slab ? all_kx[first].min : 0;
+    complex PRECISION * mean = rcvbuff + total;
+
+    req[0] = MPI_REQUEST_NULL;
+    for(j = 1; j < iosize; j++)
+        MPI_Irecv(rcvbuff + displs[j], 2 * numCheck * counts[j], MPI_PRECISION, j, IO_TAG_CHECK, iocomm, req + j);
+    req[iosize] = MPI_REQUEST_NULL;
+    if(frank == 0)
+        MPI_Irecv(mean, 2 * numMean, MPI_PRECISION, 1, IO_TAG_MEAN, iocomm, req + iosize);
+    MPI_Waitall(iosize + 1, req, MPI_STATUSES_IGNORE);
+
+    sprintf(name, "Checkpoint%d/data", dir);
+    trace("Writing to %s\n", name);
+    MPI_File_open(fcomm, name, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);
+
+    io_checkHeader(header);
+    MPI_File_write_at_all(fh, 0, header, frank == 0 ? IO_CHECK_HEADER : 0, MPI_INT, MPI_STATUS_IGNORE);
+    MPI_Offset offset = IO_CHECK_HEADER * sizeof(int);
+    MPI_File_write_at_all(fh, offset, mean, frank == 0 ? 2 * numMean : 0, MPI_PRECISION, MPI_STATUS_IGNORE);
+    offset += numMean * sz;
+
+    for(a = 0; a < numCheck; a++)
+    {
+        //rcvbuff is [v][h][array][kx][ky][kz], we want [kx][ky][kz] for one
+        //array
+        for(i = first; i <= last; i++)
+        {
+            for(j = 0; j < hdiv; j++)
+            {
+                k = 1 + (i - first) * hdiv + j;
+                complex PRECISION * in = rcvbuff + displs[k] + a * counts[k];
+                for(l = 0; l < all_kx[i].width; l++)
+                {
+                    for(m = 0; m < all_ky[j].width; m++)
+                    {
+                        int indexs = ((l + all_kx[i].min - kx0) * ndky + m + all_ky[j].min) * ndkz;
+                        memcpy(sndbuff + indexs, in, ndkz * sz);
+                        in += ndkz;
+                    }
+                }
+            }
+        }
+
+        MPI_Offset disp = offset + (MPI_Offset)kx0 * ndky * ndkz * sz;
+        MPI_File_write_at_all(fh, disp, sndbuff, 2 * slab * ndky * ndkz, MPI_PRECISION, MPI_STATUS_IGNORE);
+        offset += (MPI_Offset)ndkx * ndky * ndkz * sz;
     }
+
+    //the data has to be on disk before the state file says it is there
+    MPI_File_sync(fh);
+    MPI_File_close(&fh);
+    MPI_Barrier(fcomm);
+
+    if(frank == 0)
+    {
+        PRECISION state[3] = {head[2], head[3], head[4]};
+
+        sprintf(name, "Checkpoint%d/state", dir);
+        FILE * out = fopen(name, "w");
+        fwrite(state, sizeof(PRECISION), 3, out);
+        fwrite(&iteration, sizeof(int), 1, out);
+        fwrite(&integrator, sizeof(int), 1, out);
+        fflush(out);
+        fsync(fileno(out));
+        fclose(out);
+    }
+    debug("Checkpoint%d committed for iteration %d\n", dir, iteration);
 }
 
 /*
@@ -479,162 +1258,25 @@ void performOutput()
 
     /*
      * The scalars are single values that result from a global operation on the
-     * domain.  The scalars are:
-     * 
-     * [0]  --  iteration
-     * [1]  --  elapsed time
-     * [2]  --  min  u
-     * [3]  --  max  u
-     * [4]  --  mean u
-     * [5]  --  min  v
-     * [6]  --  max  v
-     * [7]  --  mean v
-     * [8]  --  min  w
-     * [9]  --  max  w
-     * [10] --  mean w
-     * [11] --  mean kinetic energy density
-     * [12] --  max kinetic energy density
-     * 
-     * ------------ Only present if magnetic fields are included:
-     * [13] --  min  Bx
-     * [14] --  max  Bx
-     * [15] --  mean Bx
-     * [16] --  min  By
-     * [17] --  max  By
-     * [18] --  mean By
-     * [19] --  min  Bz
-     * [20] --  max  Bz
-     * [21] --  mean Bz
-     * [22] --  mean magnetic energy density
-     * [23] --  max  magnetic energy density* 
+     * domain.  Each record is the iteration and elapsed time, followed by the
+     * diagnostics registered in diag_init (see Diagnostics.c for the list).
+     * Each Scalars file names the entries of its records after the header.
      */
     if(compute_node)
     {
         if(iteration % scalarRate == 0)
         {
-            PRECISION * local = (PRECISION*)malloc(sizeof(PRECISION)*numScalar);
-            int i;
-
-            PRECISION * datax = u->vec->x->spatial;
-            PRECISION * datay = u->vec->y->spatial;
-            PRECISION * dataz = u->vec->z->spatial;
-            PRECISION temp;
-
-            //I feel like there should be an MPI operation that doesn't require
-            //me to manually take a local min/max/etc, but I'm failing to find
-            //it.  The general MPI_Reduce does an element by element reduction,
-            //which is not what we want.
-            
-            local[0] = iteration;
-            local[1] = elapsedTime;
-            local[2] = datax[0];
-            local[3] = datax[0];
-            local[4] = datax[0];
-            local[5] = datay[0];
-            local[6] = datay[0];
-            local[7] = datay[0];
-            local[8] = dataz[0];
-            local[9] = dataz[0];
-            local[10] = dataz[0];
-            temp = pow(datax[0],2) + pow(datay[0],2) + pow(dataz[0],2);
-            local[11] = temp;
-            local[12] = temp;
-            for(i = 1; i < spatialCount; i++)
-            {
-                local[2] = fmin(local[2], datax[i]);
-                local[3] = fmax(local[3], datax[i]);
-                local[4] += datax[i];
-                local[5] = fmin(local[5], datay[i]);
-                local[6] = fmax(local[6], datay[i]);
-                local[7] += datay[i];
-                local[8] = fmin(local[8], dataz[i]);
-                local[9] = fmax(local[9], dataz[i]);
-                local[10] += dataz[i];
-                temp = pow(datax[i],2) + pow(datay[i],2) + pow(dataz[i],2);
-                local[11] += temp;
-                local[12] = fmax(temp, local[12]);
-            }
-
             if(crank == 0)
             {
-                piScalarData[0] = local[0];
-                piScalarData[1] = local[1];
+                piScalarData[0] = iteration;
+                piScalarData[1] = elapsedTime;
             }
-            MPI_Reduce(local+2, piScalarData+2, 1, MPI_PRECISION, MPI_MIN, 0, ccomm);
-            MPI_Reduce(local+3, piScalarData+3, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-            MPI_Reduce(local+4, piScalarData+4, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-            MPI_Reduce(local+5, piScalarData+5, 1, MPI_PRECISION, MPI_MIN, 0, ccomm);
-            MPI_Reduce(local+6, piScalarData+6, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-            MPI_Reduce(local+7, piScalarData+7, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-            MPI_Reduce(local+8, piScalarData+8, 1, MPI_PRECISION, MPI_MIN, 0, ccomm);
-            MPI_Reduce(local+9, piScalarData+9, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-            MPI_Reduce(local+10, piScalarData+10, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-            MPI_Reduce(local+11, piScalarData+11, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-            MPI_Reduce(local+12, piScalarData+12, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-
-            if(magEquation)
-            {
-                datax = B->vec->x->spatial;
-                datay = B->vec->y->spatial;
-                dataz = B->vec->z->spatial;
-
-                local[13] = datax[0];
-                local[14] = datax[0];
-                local[15] = datax[0];
-                local[16] = datay[0];
-                local[17] = datay[0];
-                local[18] = datay[0];
-                local[19] = dataz[0];
-                local[20] = dataz[0];
-                local[21] = dataz[0];
-                temp = pow(datax[0],2) + pow(datay[0],2) + pow(dataz[0],2);
-                local[22] = temp;
-                local[23] = temp;
-                for(i = 1; i < spatialCount; i++)
-                {
-                    local[13] = fmin(local[13], datax[i]);
-                    local[14] = fmax(local[14], datax[i]);
-                    local[15] += datax[i];
-                    local[16] = fmin(local[16], datay[i]);
-                    local[17] = fmax(local[17], datay[i]);
-                    local[18] += datay[i];
-                    local[19] = fmin(local[19], dataz[i]);
-                    local[20] = fmax(local[20], dataz[i]);
-                    local[21] += dataz[i];
-                    temp = pow(datax[i],2) + pow(datay[i],2) + pow(dataz[i],2);
-                    local[22] += temp;
-                    local[23] = fmax(temp, local[21]);
-                }
+            diag_compute(piScalarData + 2);
 
-                MPI_Reduce(local+13, piScalarData+13, 1, MPI_PRECISION, MPI_MIN, 0, ccomm);
-                MPI_Reduce(local+14, piScalarData+14, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-                MPI_Reduce(local+15, piScalarData+15, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-                MPI_Reduce(local+16, piScalarData+16, 1, MPI_PRECISION, MPI_MIN, 0, ccomm);
-                MPI_Reduce(local+17, piScalarData+17, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-                MPI_Reduce(local+18, piScalarData+18, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-                MPI_Reduce(local+19, piScalarData+19, 1, MPI_PRECISION, MPI_MIN, 0, ccomm);
-                MPI_Reduce(local+20, piScalarData+20, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-                MPI_Reduce(local+21, piScalarData+21, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-                MPI_Reduce(local+22, piScalarData+22, 1, MPI_PRECISION, MPI_SUM, 0, ccomm);
-                MPI_Reduce(local+23, piScalarData+23, 1, MPI_PRECISION, MPI_MAX, 0, ccomm);
-            }
-            free(local);
-            
             //Either store our data for later output, or perform the write to 
             //file
             if(crank == 0)
             {
-                //make the means means and not sums
-                piScalarData[4] /= (nx*ny*nz);
-                piScalarData[7] /= (nx*ny*nz);
-                piScalarData[10] /= (nx*ny*nz);
-                if(magEquation)
-                {
-                    piScalarData[15] /= (nx*ny*nz);
-                    piScalarData[18] /= (nx*ny*nz);
-                    piScalarData[21] /= (nx*ny*nz);
-                }
-
                 scalarCount++;
                 piScalarData += numScalar;
 
@@ -645,7 +1287,12 @@ void performOutput()
                     char fileName[100];
                     sprintf(fileName, "Scalars/%08d",iteration);
 
+                    unsigned char head[IO_FILE_HEAD];
+                    io_fileHeader(head, IO_FILE_SCALARS, numScalar, scalarPerF);
+
                     FILE * out = fopen(fileName, "w");
+                    fwrite(head, 1, IO_FILE_HEAD, out);
+                    fwrite(scalarNames, 1, numScalar * IO_NAME, out);
                     fwrite(scalarData, sizeof(PRECISION), numScalar * scalarPerF, out);
                     fclose(out);
 
@@ -656,113 +1303,48 @@ void performOutput()
         }
     }
     
-    //Time for spatial file output?
-    if(iteration % spatialRate == 0)
+    //Time for spatial file output?  Our IO node takes it from here.
+    if(iteration % spatialRate == 0 && numSpatial > 0)
     {
-        char * name = (char *)malloc(100);
-        
-        //create the directory
-        if(crank == 0)
-        {
-            sprintf(name, "Spatial/%08d",iteration);
-            mkdir(name, S_IRWXU);
-
-            //Record the simulation time that this snapshot belongs to
-            sprintf(name, "Spatial/%08d/info",iteration);
-            FILE * info;
-            info = fopen(name, "w");
-            fprintf(info, infostro, elapsedTime);
-            fclose(info);
-        }
-        MPI_Barrier(MPI_COMM_WORLD);
-
         if(compute_node)
         {
-            if(momEquation || kinematic)
-            {
-                trace("Outputing u\n");
-                writeSpatial(u->vec->x,0);
-
-                trace("Outputing v\n");
-                writeSpatial(u->vec->y,0);
-
-                trace("Outputing w\n");
-                writeSpatial(u->vec->z,0);
-            }
-            if(tEquation)
-            {
-                trace("Outputting T\n");
-                writeSpatial(T, 0);
-            }
-            if(magEquation)
-            {
-                trace("Outputing Bx\n");
-                writeSpatial(B->vec->x,0);
-
-                trace("Outputing By\n");
-                writeSpatial(B->vec->y,0);
-
-                trace("Outputing Bz\n");
-                writeSpatial(B->vec->z,0);
-            }
-        }
-        else if(io_node)
-        {
-            if(momEquation || kinematic)
-            {
-                sprintf(name, "Spatial/%08d/u", iteration);
-                trace("Writing to file %s\n", name);
-                writeSpatial(0, name);
-
-                sprintf(name, "Spatial/%08d/v", iteration);
-                trace("Writing to file %s\n", name);
-                writeSpatial(0, name);
-
-                sprintf(name, "Spatial/%08d/w", iteration);
-                trace("Writing to file %s\n", name);
-                writeSpatial(0, name);
-            }
-            if(tEquation)
-            {
-                sprintf(name, "Spatial/%08d/T", iteration);
-                trace("Writing to file %s\n", name);
-                writeSpatial(0, name);
-            }
-            if(magEquation)
-            {
-                sprintf(name, "Spatial/%08d/Bx", iteration);
-                trace("Writing to file %s\n", name);
-                writeSpatial(0, name);
-
-                sprintf(name, "Spatial/%08d/By", iteration);
-                trace("Writing to file %s\n", name);
-                writeSpatial(0, name);
-
-                sprintf(name, "Spatial/%08d/Bz", iteration);
-                trace("Writing to file %s\n", name);
-                writeSpatial(0, name);
-            }
+            io_postSpatial();
         }
-
-        free(name);
     }
 
     if(iteration % checkRate == 0)
     {
         if(compute_node)
+        {
+            prof_start(PROF_CHECKPOINT);
             writeCheckpoint();
+            prof_stop(PROF_CHECKPOINT);
+        }
     }
 }
 
 #include "LogTrace.h"
 
 /*
- * This routine is virtually a memory dump.  There is no reason to gather data
- * to IO nodes, we are just going to open up files for each processor and dump
- * our section of the global array there.  We are also going to dump all of the
- * stored forcing evaluations.  The design is that any simulation that begins
- * from one of these checkpoints will be identical to a simulation that did
- * not stop in the first place.
+ * Everything needed to restart goes into a single file per checkpoint,
+ * Checkpoint%d/data.  The layout is
+ * 
+ * 1.   A header of IO_CHECK_HEADER ints: nx, ny, nz, sizeof(PRECISION), the
+ *      momentum, magnetic and temperature equation flags, and diffusionMethod,
+ *      since the stored forces only include diffusion when it is explicit.
+ * 2.   The mean flows that only the root compute node holds, in the order 
+ *      given by io_checkArrays.
+ * 3.   Each spectral array and its stored forcing evaluations, one after the
+ *      other, as a global [kx][ky][kz] array of the de-aliased modes.
+ * 
+ * Since nothing in the file depends on how the modes were divided up, a 
+ * simulation can be restarted with any hdiv and vdiv.  The design is still
+ * that any simulation that begins from one of these checkpoints will be
+ * identical to a simulation that did not stop in the first place.
+ * 
+ * Here we only copy the arrays into the next staging buffer and hand them to
+ * our IO node, which writes the file in the background (see io_serveCheck)
+ * while we keep iterating.
  * 
  * Since this program is capable of terminating at any point in time, we take 
  * measures to ensure that the program does not terminate DURING a checkpoint
@@ -771,186 +1353,45 @@ void performOutput()
  * and the final thing written during an output is a single file indicating 
  * that IO is done.  This way we always have a pristine checkpoint file that
  * we can restart from, regardless of when the program happens to terminate.
- * 
- * TODO: This folder gets very cluttered, especially with a lot of processors.
- *       Things should be changed so each processor gets one file, rather than
- *       one file per array being saved.
  */
 void writeCheckpoint()
 {
-    FILE * out;
-    char name[100];
-
-    trace("Writing to Checkpoint%d\n", checkDir);
-
-    if(momEquation)
+    int i;
+    complex PRECISION * arrays[IO_MAX_CHECK];
+    int lengths[IO_MAX_CHECK];
+    int b = checkNext;
+
+    trace("Staging checkpoint for Checkpoint%d\n", checkDir);
+
+    //This only blocks if our IO node is still busy with the checkpoint before
+    //last
+    MPI_Waitall(3, checkReq[b], MPI_STATUSES_IGNORE);
+
+    //spectral arrays first, then the mean flows after them
+    int n = io_checkArrays(arrays, lengths);
+    complex PRECISION * spec = checkStage[b];
+    complex PRECISION * mean = checkStage[b] + numCheck * spectralCount;
+    for(i = 0; i < n; i++)
     {
-        sprintf(name,"Checkpoint%d/upol%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->poloidal->spectral, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/upolf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->poloidal->force1, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/upolf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->poloidal->force2, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/utor%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->toroidal->spectral, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/utorf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->toroidal->force1, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/utorf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->toroidal->force2, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/umx%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->mean_x, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/umxf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->mean_xf1, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/umxf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->mean_xf2, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/umy%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->mean_y, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/umyf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->mean_yf1, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/umyf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(u->sol->mean_yf2, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/umz%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(&(u->sol->mean_z), sizeof(complex PRECISION), 1, out);
-        fclose(out);
-    }
-
-    if(magEquation)
-    {
-        sprintf(name,"Checkpoint%d/bpol%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->poloidal->spectral, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bpolf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->poloidal->force1, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bpolf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->poloidal->force2, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/btor%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->toroidal->spectral, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/btorf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->toroidal->force1, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/btorf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->toroidal->force2, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bmx%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->mean_x, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bmxf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->mean_xf1, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bmxf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->mean_xf2, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bmy%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->mean_y, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bmyf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->mean_yf1, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bmyf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(B->sol->mean_yf2, sizeof(complex PRECISION), ndkz, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/bmz%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(&(B->sol->mean_z), sizeof(complex PRECISION), 1, out);
-        fclose(out);
-    }
-
-    if(tEquation)
-    {
-        sprintf(name,"Checkpoint%d/T%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(T->spectral, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/Tf1%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(T->force1, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
-
-        sprintf(name,"Checkpoint%d/Tf2%d", checkDir, crank);
-        out = fopen(name,"w");
-        fwrite(T->force2, sizeof(complex PRECISION), spectralCount, out);
-        fclose(out);
+        if(lengths[i])
+        {
+            memcpy(mean, arrays[i], lengths[i] * sizeof(complex PRECISION));
+            mean += lengths[i];
+        }
+        else
+        {
+            memcpy(spec, arrays[i], spectralCount * sizeof(complex PRECISION));
+            spec += spectralCount;
+        }
     }
-    
-    //finish all the important data.  Then update the state file so we know
-    //things are completed
-    MPI_Barrier(ccomm);
 
+    MPI_Isend(checkStage[b], 2 * numCheck * spectralCount, MPI_PRECISION, 0, IO_TAG_CHECK, iocomm, checkReq[b]);
+    checkReq[b][1] = MPI_REQUEST_NULL;
     if(crank == 0)
-    {
-        sprintf(name, "Checkpoint%d/state", checkDir);
-        FILE * out = fopen(name, "w");
-        fwrite(&elapsedTime, sizeof(PRECISION), 1, out);
-        fwrite(&dt, sizeof(PRECISION), 1, out);
-        fwrite(&dt1, sizeof(PRECISION), 1, out);
-        fwrite(&iteration, sizeof(int), 1, out);
-        fclose(out);
-    }
+        MPI_Isend(checkStage[b] + numCheck * spectralCount, 2 * numMean, MPI_PRECISION, 0, IO_TAG_MEAN, iocomm, checkReq[b] + 1);
+    io_postHead(checkHead[b], IO_DUMP_CHECK, checkReq[b] + 2);
+
+    checkNext = 1 - b;
 
     //Switch which directory we write to next
     if(checkDir == 0)
@@ -960,9 +1401,10 @@ void writeCheckpoint()
 }
 
 /*
- * This is largely the inverse of the write method.  In order for this to work, 
- * the program MUST be run with the same number of compute nodes as previously
- * ran. 
+ * This is largely the inverse of the write method.  Each compute node reads
+ * the block of modes it owns under the current hdiv and vdiv, which need not
+ * be the ones the checkpoint was written with.  The grid, precision and set
+ * of equations do have to match.
  * 
  * The only extra bit is we here have to determine which checkpoint file is the
  * one to start from.  An earlier IO method ensures that the two directories 
@@ -981,6 +1423,8 @@ void readCheckpoint()
         PRECISION dDt;
         PRECISION dDt1;
         int dIteration;
+        int dIntegrator = INTEGRATE_AB3;
+        int written = INTEGRATE_AB3;
 
         FILE * out = fopen("Checkpoint0/state", "r");
         if(out == 0)
@@ -991,6 +1435,7 @@ void readCheckpoint()
         fread(&dDt, sizeof(PRECISION), 1, out);
         fread(&dDt1, sizeof(PRECISION), 1, out);
         fread(&dIteration, sizeof(int), 1, out);
+        fread(&dIntegrator, sizeof(int), 1, out);
         fclose(out);
 
         out = fopen("Checkpoint1/state", "r");
@@ -1002,6 +1447,7 @@ void readCheckpoint()
         fread(&dt, sizeof(PRECISION), 1, out);
         fread(&dt1, sizeof(PRECISION), 1, out);
         fread(&iteration, sizeof(int), 1, out);
+        fread(&written, sizeof(int), 1, out);
         fclose(out);
 
         if(iteration > dIteration)
@@ -1015,8 +1461,16 @@ void readCheckpoint()
             elapsedTime = dElapsed;
             dt = dDt;
             dt1 = dDt1;
+            written = dIntegrator;
         }
 
+        //Older state files stop at the iteration, and were all written by AB3.
+        //Runge-Kutta keeps no past forces, so AB3 has to ramp up again.
+        if(integrator == INTEGRATE_AB3 && written != INTEGRATE_AB3)
+        {
+            info("Checkpoint was written by a Runge-Kutta run, ramping AB3 up from iteration %d\n", iteration);
+            historyStart = iteration;
+        }
     }
 
     //Let all processors know where we currently are in this simulation.
@@ -1025,82 +1479,69 @@ void readCheckpoint()
     MPI_Bcast(&dt, 1, MPI_PRECISION, 0, MPI_COMM_WORLD);
     MPI_Bcast(&dt1, 1, MPI_PRECISION, 0, MPI_COMM_WORLD);
     MPI_Bcast(&checkDir, 1, MPI_INTEGER, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&historyStart, 1, MPI_INTEGER, 0, MPI_COMM_WORLD);
 
 
     if(compute_node)
     {
-        FILE * in;
+        int i;
         char name[100];
+        complex PRECISION * arrays[IO_MAX_CHECK];
+        int lengths[IO_MAX_CHECK];
+        int header[IO_CHECK_HEADER];
+        int expect[IO_CHECK_HEADER];
+        MPI_Datatype ctype;
+        MPI_Datatype block;
+        MPI_Offset disp;
+        MPI_Offset offset;
+        MPI_File fh;
 
         trace("Reading from Checkpoint%d", checkDir);
 
-        if(momEquation)
+        int n = io_checkArrays(arrays, lengths);
+        io_checkTypes(&ctype, &block, &disp);
+        io_checkHeader(expect);
+
+        sprintf(name, "Checkpoint%d/data", checkDir);
+        if(MPI_File_open(ccomm, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+        {
+            error("Failed to open %s!  Crashing gracelessly...\n", name);
+            abort();
+        }
+
+        MPI_File_read_at_all(fh, 0, header, IO_CHECK_HEADER, MPI_INT, MPI_STATUS_IGNORE);
+        for(i = 0; i < IO_CHECK_HEADER; i++)
         {
-            sprintf(name,"Checkpoint%d/upol%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->poloidal->spectral, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/upolf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->poloidal->force1, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/upolf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->poloidal->force2, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/utor%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->toroidal->spectral, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/utorf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->toroidal->force1, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/utorf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->toroidal->force2, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/umx%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->mean_x, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/umxf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->mean_xf1, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/umxf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->mean_xf2, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/umy%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->mean_y, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/umyf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->mean_yf1, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/umyf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(u->sol->mean_yf2, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/umz%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(&(u->sol->mean_z), sizeof(complex PRECISION), 1, in);
-            fclose(in);
+            if(header[i] != expect[i])
+            {
+                error("%s was written for a %dx%dx%d grid with %d byte reals, equations %d %d %d and diffusion method %d.  It cannot be used here\n", name, header[0], header[1], header[2], header[3], header[4], header[5], header[6], header[7]);
+                abort();
+            }
+        }
+        offset = IO_CHECK_HEADER * sizeof(int);
+
+        for(i = 0; i < n; i++)
+        {
+            if(lengths[i])
+            {
+                MPI_File_read_at_all(fh, offset, arrays[i], lengths[i], ctype, MPI_STATUS_IGNORE);
+                offset += lengths[i] * sizeof(complex PRECISION);
+            }
+            else
+            {
+                MPI_File_set_view(fh, offset + disp, ctype, block, "native", MPI_INFO_NULL);
+                MPI_File_read_at_all(fh, 0, arrays[i], spectralCount, ctype, MPI_STATUS_IGNORE);
+                MPI_File_set_view(fh, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+                offset += (MPI_Offset)ndkx * ndky * ndkz * sizeof(complex PRECISION);
+            }
+        }
+
+        MPI_File_close(&fh);
+        MPI_Type_free(&block);
+        MPI_Type_free(&ctype);
 
+        if(momEquation)
+        {
             recomposeSolenoidal(u->sol, u->vec);
             fftBackward(u->vec->x);
             fftBackward(u->vec->y);
@@ -1109,71 +1550,6 @@ void readCheckpoint()
 
         if(magEquation)
         {
-            sprintf(name,"Checkpoint%d/bpol%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->poloidal->spectral, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bpolf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->poloidal->force1, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bpolf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->poloidal->force2, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/btor%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->toroidal->spectral, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/btorf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->toroidal->force1, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/btorf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->toroidal->force2, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bmx%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->mean_x, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bmxf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->mean_xf1, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bmxf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->mean_xf2, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bmy%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->mean_y, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bmyf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->mean_yf1, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bmyf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(B->sol->mean_yf2, sizeof(complex PRECISION), ndkz, in);
-            fclose(in);
-
-            sprintf(name,"Checkpoint%d/bmz%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(&(B->sol->mean_z), sizeof(complex PRECISION), 1, in);
-            fclose(in);
-
             recomposeSolenoidal(B->sol, B->vec);
             fftBackward(B->vec->x);
             fftBackward(B->vec->y);
@@ -1182,23 +1558,116 @@ void readCheckpoint()
 
         if(tEquation)
         {
-            sprintf(name,"Checkpoint%d/T%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(T->spectral, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
+            fftBackward(T);
+        }
 
-            sprintf(name,"Checkpoint%d/Tf1%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(T->force1, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
+    }
 
-            sprintf(name,"Checkpoint%d/Tf2%d", checkDir, crank);
-            in = fopen(name,"r");
-            fread(T->force2, sizeof(complex PRECISION), spectralCount, in);
-            fclose(in);
+    //The next checkpoint goes in the other directory, so the one we started
+    //from stays intact until it has been replaced
+    if(checkDir == 0)
+        checkDir = 1;
+    else
+        checkDir = 0;
+}
 
-            fftBackward(T);
-        }
+/*
+ * The arrays making up a checkpoint, in the order they appear in the file.
+ * lengths[i] is 0 for spectral arrays spread over all compute nodes, and
+ * otherwise the number of elements in a mean flow array held by the root.
+ */
+static int io_checkArrays(complex PRECISION ** arrays, int * lengths)
+{
+    int n = 0;
+    int i;
+    p_solenoid sols[2];
+    int nsols = 0;
 
+    if(momEquation)
+        sols[nsols++] = u->sol;
+    if(magEquation)
+        sols[nsols++] = B->sol;
+
+    for(i = 0; i < nsols; i++)
+    {
+        arrays[n] = sols[i]->mean_x;
+        lengths[n++] = ndkz;
+        arrays[n] = sols[i]->mean_xf1;
+        lengths[n++] = ndkz;
+        arrays[n] = sols[i]->mean_xf2;
+        lengths[n++] = ndkz;
+        arrays[n] = sols[i]->mean_y;
+        lengths[n++] = ndkz;
+        arrays[n] = sols[i]->mean_yf1;
+        lengths[n++] = ndkz;
+        arrays[n] = sols[i]->mean_yf2;
+        lengths[n++] = ndkz;
+        arrays[n] = &(sols[i]->mean_z);
+        lengths[n++] = 1;
+    }
+
+    for(i = 0; i < nsols; i++)
+    {
+        arrays[n] = sols[i]->poloidal->spectral;
+        lengths[n++] = 0;
+        arrays[n] = sols[i]->poloidal->force1;
+        lengths[n++] = 0;
+        arrays[n] = sols[i]->poloidal->force2;
+        lengths[n++] = 0;
+        arrays[n] = sols[i]->toroidal->spectral;
+        lengths[n++] = 0;
+        arrays[n] = sols[i]->toroidal->force1;
+        lengths[n++] = 0;
+        arrays[n] = sols[i]->toroidal->force2;
+        lengths[n++] = 0;
+    }
+
+    if(tEquation)
+    {
+        arrays[n] = T->spectral;
+        lengths[n++] = 0;
+        arrays[n] = T->force1;
+        lengths[n++] = 0;
+        arrays[n] = T->force2;
+        lengths[n++] = 0;
     }
+
+    return n;
+}
+
+/*
+ * What a checkpoint written by this run has to start with, see writeCheckpoint.
+ */
+static void io_checkHeader(int * header)
+{
+    header[0] = nx;
+    header[1] = ny;
+    header[2] = nz;
+    header[3] = sizeof(PRECISION);
+    header[4] = momEquation;
+    header[5] = magEquation;
+    header[6] = tEquation;
+    header[7] = diffusionMethod;
+}
+
+/*
+ * ctype is a single complex number.  block is our [kx][ky][kz] piece of a 
+ * global spectral array, and disp is where that piece starts in bytes.  Built
+ * from vectors rather than MPI_Type_create_subarray, which rejects processors
+ * that own no modes.
+ */
+static void io_checkTypes(MPI_Datatype * ctype, MPI_Datatype * block, MPI_Offset * disp)
+{
+    MPI_Datatype inner;
+    int sz = sizeof(complex PRECISION);
+
+    MPI_Type_contiguous(2, MPI_PRECISION, ctype);
+    MPI_Type_commit(ctype);
+
+    MPI_Type_contiguous(my_ky->width * ndkz, *ctype, &inner);
+    MPI_Type_create_hvector(my_kx->width, 1, (MPI_Aint)ndky * ndkz * sz, inner, block);
+    MPI_Type_commit(block);
+    MPI_Type_free(&inner);
+
+    *disp = ((MPI_Offset)my_kx->min * ndky + my_ky->min) * ndkz * sz;
 }
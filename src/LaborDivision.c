@@ -19,11 +19,24 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "Environment.h"
 #include "LaborDivision.h"
+#include "Communication.h"
+#include "Field.h"
 #include "Log.h"
 
+//How many of the best layouts by estimate get a measured trial
+#define LAYOUT_TRIALS 3
+//Rough cost of one message in an all-to-all, in units of elements moved
+#define MESSAGE_COST 1024.0
+
+double lab_layoutCost(int h, int v);
+double lab_layoutTrial(int h, int v);
+int * lab_nodeOf();
+void lab_placeRanks(int * place);
+
 /*
  * This routine is in charge of things related to the size of the problem.
  * Most notably it calculates the number of wavemodes, which are derived from
@@ -76,6 +89,157 @@ void lab_initGeometry()
 }
 
 
+/*
+ * Used when the configuration file asks for hdiv=auto.  Every hdiv x vdiv
+ * layout that fits in the processors left over after the IO nodes is scored
+ * with lab_layoutCost, and the cheapest is used.  With autoTrial on, the best
+ * few are also set up for real and timed over a handful of transforms, and the
+ * fastest of those wins instead.  Every processor comes to the same answer.
+ */
+void lab_chooseLayout()
+{
+    int h,v,i;
+    int procs = gsize - n_io_nodes;
+    int best[LAYOUT_TRIALS][2];
+    double cost[LAYOUT_TRIALS];
+    int count = 0;
+
+    info("Choosing the processor layout for %d compute nodes\n", procs);
+
+    //ndkx and ndky limit how finely the spectral directions can be split
+    lab_initGeometry();
+
+    for(h = 1; h <= procs; h++)
+    {
+        for(v = 1; h * v <= procs; v++)
+        {
+            //every processor needs at least one of each distributed index,
+            //and every IO node needs at least one row
+            if(h > nx || h > ndky || v > nz || v > ndkx || v < n_io_nodes)
+                continue;
+
+            double c = lab_layoutCost(h, v);
+            trace("Layout %dx%d has estimated cost %g\n", h, v, c);
+
+            //keep the cheapest few, in order
+            for(i = count; i > 0 && c < cost[i - 1]; i--)
+            {
+                if(i < LAYOUT_TRIALS)
+                {
+                    cost[i] = cost[i - 1];
+                    best[i][0] = best[i - 1][0];
+                    best[i][1] = best[i - 1][1];
+                }
+            }
+            if(i < LAYOUT_TRIALS)
+            {
+                cost[i] = c;
+                best[i][0] = h;
+                best[i][1] = v;
+                if(count < LAYOUT_TRIALS)
+                    count++;
+            }
+        }
+    }
+
+    if(count == 0)
+    {
+        error("No processor layout fits %d compute nodes with %d IO nodes on a %dx%dx%d grid\n", procs, n_io_nodes, nx, ny, nz);
+        abort();
+    }
+
+    int choice = 0;
+    if(autoTrial && count > 1)
+    {
+        double fastest = 0;
+        for(i = 0; i < count; i++)
+        {
+            double t = lab_layoutTrial(best[i][0], best[i][1]);
+            info("Layout %dx%d: estimate %g, measured %g s\n", best[i][0], best[i][1], cost[i], t);
+            if(i == 0 || t < fastest)
+            {
+                fastest = t;
+                choice = i;
+            }
+        }
+    }
+
+    hdiv = best[choice][0];
+    vdiv = best[choice][1];
+    info("Using processor layout hdiv = %d, vdiv = %d\n", hdiv, vdiv);
+}
+
+/*
+ * An estimate of how long one transform takes on an h x v layout.  Every stage
+ * waits on the processor with the biggest pencil, so uneven divisions show up
+ * through the max widths.  fft1 pads every block it sends out to the biggest
+ * block, so the transposes move h (or v) max sized blocks.  Each peer in an
+ * all-to-all also costs a message, which is what keeps a long thin layout from
+ * looking as good as a square one.
+ */
+double lab_layoutCost(int h, int v)
+{
+    double mx = (nx + h - 1) / h;
+    double mky = (ndky + h - 1) / h;
+    double mz = (nz + v - 1) / v;
+    double mkx = (ndkx + v - 1) / v;
+
+    double ffts = mz * mx * ny + mz * mky * nx + mkx * mky * nz;
+    double moved = h * mz * mx * mky + v * mz * mky * mkx;
+
+    return ffts + moved + MESSAGE_COST * (h + v - 2);
+}
+
+/*
+ * Sets up an h x v layout, times a few forward and backward transforms on it,
+ * and tears it back down.  Collective over all processors, and every one of
+ * them gets the time of the slowest compute node.
+ */
+double lab_layoutTrial(int h, int v)
+{
+    int i;
+    int reps = 5;
+    double t = 0;
+
+    hdiv = h;
+    vdiv = v;
+    lab_initGroups();
+    lab_initDistributions();
+
+    if(compute_node)
+    {
+        field f;
+        com_init(0);
+        allocateSpatial(&f);
+        allocateSpectral(&f);
+        memset(f.spatial, 0, spatialCount * sizeof(PRECISION));
+
+        //the first pair pays for anything left over from planning
+        fftForward(&f);
+        fftBackward(&f);
+
+        MPI_Barrier(ccomm);
+        t = MPI_Wtime();
+        for(i = 0; i < reps; i++)
+        {
+            fftForward(&f);
+            fftBackward(&f);
+        }
+        t = (MPI_Wtime() - t) / reps;
+        MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, ccomm);
+
+        eraseSpatial(&f);
+        eraseSpectral(&f);
+        com_finalize();
+    }
+
+    //compute nodes come first, so grank 0 has the answer
+    MPI_Bcast(&t, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    lab_finalize();
+
+    return t;
+}
+
 /*
  * Here we must set up the MPI communication groups.  There are 5:
  * 
@@ -94,6 +258,9 @@ void lab_initGeometry()
  *      c05 c06 c07 c08    I18
  *      c09 c10 c11 c12    I19
  *      c13 c14 c15 c16    I20
+ *
+ * The numbers above are slots rather than global ranks.  They are the same
+ * unless nodePlacement is on, in which case see lab_placeRanks.
  */
 void lab_initGroups()
 {
@@ -141,15 +308,26 @@ void lab_initGroups()
 
     my_io_layer = -1;
 
-    //layout for the pencils.  A row is defined by consecutive processors
-    //in the global group
-
-    if(grank < hdiv * vdiv)
+    //layout for the pencils.  By default a row is defined by consecutive
+    //processors in the global group, but lab_placeRanks may move processors
+    //around so that transposes stay on a node.  Everything below works in
+    //terms of slots in the logical layout, and place maps a slot back to the
+    //global rank sitting in it.
+    int * place = (int*)malloc(gsize * sizeof(int));
+    int * ranks = (int*)malloc(gsize * sizeof(int));
+    lab_placeRanks(place);
+
+    int slot = 0;
+    while(place[slot] != grank)
+        slot++;
+    debug("Global rank %d sits in slot %d\n", grank, slot);
+
+    if(slot < hdiv * vdiv)
     {
         compute_node = 1;
         io_node = 0;
     }
-    else if(grank < hdiv*vdiv + n_io_nodes)
+    else if(slot < hdiv*vdiv + n_io_nodes)
     {
         compute_node = 0;
         io_node = 1;
@@ -171,35 +349,26 @@ void lab_initGroups()
     MPI_Comm_group(MPI_COMM_WORLD, &global);
 
     
-    //logical compute grid is set up so that rows are contiguous in the global
-    //group, and compute nodes come before the IO nodes.
+    //logical compute grid is set up so that rows are contiguous in the slots,
+    //and compute nodes come before the IO nodes.
     if(compute_node)
     {
         debug("Setting up hcomm and vcomm\n");
         //set up the groups for inernal transposes and such
-        int row = grank / hdiv;
-        int col = grank % hdiv;
+        int row = slot / hdiv;
+        int col = slot % hdiv;
         debug("row col = %d %d\n", row, col);
 
-        int ytrip[1][3];
-        int ztrip[1][3];
-
-        ytrip[0][0] = row * hdiv;             //start index of our row
-        ytrip[0][1] = (row+1)*hdiv - 1;       //final index of our row
-        ytrip[0][2] = 1;                      //stride between elements of our row
-        trace("tripplet for horizontal group: %d %d %d\n", ytrip[0][0], ytrip[0][1], ytrip[0][2]);
-
-        ztrip[0][0] = col;                    //start index of our column
-        ztrip[0][1] = (vdiv-1)*hdiv + col;    //final index of our column
-        ztrip[0][2] = hdiv;                   //stride between elements of our column
-        trace("tripplet for vertical group: %d %d %d\n", ztrip[0][0], ztrip[0][1], ztrip[0][2]);
-
         trace("Creating slab groups\n");
         //create groups for our horizontal and vertical associations
         MPI_Group hgroup;
         MPI_Group vgroup;
-        MPI_Group_range_incl(global, 1, ytrip, &hgroup);
-        MPI_Group_range_incl(global, 1, ztrip, &vgroup);
+        for(i = 0; i < hdiv; i++)
+            ranks[i] = place[row * hdiv + i];
+        MPI_Group_incl(global, hdiv, ranks, &hgroup);
+        for(i = 0; i < vdiv; i++)
+            ranks[i] = place[i * hdiv + col];
+        MPI_Group_incl(global, vdiv, ranks, &vgroup);
 
         trace("Creating communicators for groups\n");
         //get the communicators for our groups
@@ -226,20 +395,15 @@ void lab_initGroups()
         MPI_Comm_create(MPI_COMM_WORLD, MPI_GROUP_EMPTY, &vcomm);
     }
 
-    //prep computational comm
+    //prep computational comm.  Ranks in it match the slots, so crank is the
+    //same for a given piece of the domain however the processors were placed.
     if(compute_node)
     {
         debug("Setting up compute nodes group\n");
-        int ctrip[1][3];
-
-        ctrip[0][0] = 0;                 //start index of our row
-        ctrip[0][1] = hdiv*vdiv-1;       //final index of our row
-        ctrip[0][2] = 1;                 //stride between elements of our row
-        trace("Tripplet for compute node group: %d %d %d\n", ctrip[0][0], ctrip[0][1], ctrip[0][2]);
 
         trace("Creating group\n");
         MPI_Group cgroup;
-        MPI_Group_range_incl(global, 1, ctrip, &cgroup);
+        MPI_Group_incl(global, hdiv*vdiv, place, &cgroup);
 
         trace("Getting communicator\n");
         //get the communicators for our groups
@@ -260,17 +424,11 @@ void lab_initGroups()
     if(io_node)
     {
         debug("Create group for parallel IO\n");
-        int iotrip[1][3];
-
-        iotrip[0][0] = vdiv * hdiv;                     //start index of our row
-        iotrip[0][1] = iotrip[0][0] + n_io_nodes - 1;   //final index of our row
-        iotrip[0][2] = 1;                               //stride between elements of our row
-        trace("Tripplet for group creation: %d %d %d\n", iotrip[0][0], iotrip[0][1], iotrip[0][2]);
 
         //create groups for our horizontal and vertical associations
         trace("Creating Group\n");
         MPI_Group fgroup;
-        MPI_Group_range_incl(global, 1, iotrip, &fgroup);
+        MPI_Group_incl(global, n_io_nodes, place + vdiv * hdiv, &fgroup);
 
         trace("Getting communicator\n");
         //get the communicators for our groups
@@ -295,22 +453,19 @@ void lab_initGroups()
     {
         debug("Creating group for moving data to IO nodes\n");
         //create the comm group for consolidating data to IO nodes
-        int iotrip[2][3];
-
-        //We want the IO node to be root in this group.
-        iotrip[0][0] = vdiv * hdiv + my_io_layer;
-        iotrip[0][1] = vdiv * hdiv + my_io_layer;
-        iotrip[0][2] = 1;
+        int first = hdiv * io_layers[my_io_layer].min;
+        int count = hdiv * io_layers[my_io_layer].width;
 
-        //Compute nodes next.
-        iotrip[1][0] = hdiv * io_layers[my_io_layer].min;   //start index of our row
-        iotrip[1][1] = hdiv * io_layers[my_io_layer].max + hdiv - 1;   //final index of our row
-        iotrip[1][2] = 1;                                    //stride between elements of our row
-        trace("Tripplets for group: %d %d %d %d %d %d\n", iotrip[0][0], iotrip[0][1], iotrip[0][2], iotrip[1][0], iotrip[1][1], iotrip[1][2])
+        //We want the IO node to be root in this group, then the rows of
+        //compute nodes it owns.
+        ranks[0] = place[vdiv * hdiv + my_io_layer];
+        for(i = 0; i < count; i++)
+            ranks[i + 1] = place[first + i];
+        trace("IO group root %d with compute slots %d to %d\n", ranks[0], first, first + count - 1);
 
         trace("Creating group\n");
         MPI_Group iogroup;
-        MPI_Group_range_incl(global, 2, iotrip, &iogroup);
+        MPI_Group_incl(global, count + 1, ranks, &iogroup);
 
         trace("Creating Comm\n");
         //get the communicators for our groups
@@ -327,10 +482,204 @@ void lab_initGroups()
         MPI_Comm_create(MPI_COMM_WORLD, MPI_GROUP_EMPTY, &iocomm);
     }
 
+    free(place);
+    free(ranks);
+
     info("Communication Groups Done\n");
 
 }
 
+/*
+ * Every processor learns which node every processor lives on.  A node is named
+ * by the lowest global rank that shares memory with it.  The caller frees the
+ * returned array.
+ */
+int * lab_nodeOf()
+{
+    MPI_Comm node;
+    int leader;
+    int * nodes = (int*)malloc(gsize * sizeof(int));
+
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, grank, MPI_INFO_NULL, &node);
+    MPI_Allreduce(&grank, &leader, 1, MPI_INT, MPI_MIN, node);
+    MPI_Comm_free(&node);
+
+    MPI_Allgather(&leader, 1, MPI_INT, nodes, 1, MPI_INT, MPI_COMM_WORLD);
+
+    return nodes;
+}
+
+/*
+ * Decides which global rank sits in each slot of the logical layout, where
+ * slots are numbered as in the example above lab_initGroups.  Without
+ * nodePlacement every processor sits in the slot matching its rank.
+ *
+ * With nodePlacement, whichever of the row (hcomm) or column (vcomm) transposes
+ * moves more data is treated as the heavy one, and its groups are packed onto
+ * nodes first: each node hands out as many whole groups as it holds, and only
+ * what is left over gets mixed across nodes.  Whatever the compute grid does
+ * not use becomes the IO nodes.  Global rank 0 always keeps slot 0, since
+ * plenty of the code expects it to be the first compute node.
+ */
+void lab_placeRanks(int * place)
+{
+    int i,j,k;
+    int compute = hdiv * vdiv;
+
+    for(i = 0; i < gsize; i++)
+        place[i] = i;
+
+    if(!nodePlacement)
+        return;
+
+    int * nodes = lab_nodeOf();
+
+    //elements each processor sends away in one transpose, estimated the same
+    //way as in lab_layoutCost
+    double mx = (nx + hdiv - 1) / hdiv;
+    double mky = (ndky + hdiv - 1) / hdiv;
+    double mz = (nz + vdiv - 1) / vdiv;
+    double mkx = (ndkx + vdiv - 1) / vdiv;
+    double hmoved = (hdiv - 1) * mz * mx * mky;
+    double vmoved = (vdiv - 1) * mz * mky * mkx;
+
+    int rows = hmoved >= vmoved;
+    int size = rows ? hdiv : vdiv;      //processors in one heavy group
+    int groups = rows ? vdiv : hdiv;    //number of heavy groups
+    info("Placing %s groups on nodes: %g elements sent per transpose in hcomm, %g in vcomm\n", rows ? "hcomm" : "vcomm", hmoved, vmoved);
+
+    //Sort the processors by node, keeping them in rank order within a node.
+    //Nodes are named by a rank, so a counting sort on the name does it.
+    int * order = (int*)malloc(gsize * sizeof(int));
+    int * start = (int*)calloc(gsize + 1, sizeof(int));
+    for(i = 0; i < gsize; i++)
+        start[nodes[i] + 1]++;
+    for(i = 1; i <= gsize; i++)
+        start[i] += start[i-1];
+    for(i = 0; i < gsize; i++)
+        order[start[nodes[i]]++] = i;
+
+    //Hand out whole groups from each node.  Anything a node cannot fill a
+    //whole group with spills over, still in node order.
+    int * grouped = (int*)malloc(compute * sizeof(int));
+    int * spill = (int*)malloc(gsize * sizeof(int));
+    int filled = 0;
+    int nspill = 0;
+    for(i = 0; i < gsize; i = j)
+    {
+        for(j = i; j < gsize && nodes[order[j]] == nodes[order[i]]; j++);
+
+        for(k = i; j - k >= size && filled < groups; k += size)
+        {
+            memcpy(grouped + filled * size, order + k, size * sizeof(int));
+            filled++;
+        }
+        for(; k < j; k++)
+            spill[nspill++] = order[k];
+    }
+    info("%d of %d %s groups fit on a single node\n", filled, groups, rows ? "hcomm" : "vcomm");
+
+    //setupEnvironment already made sure there are enough processors
+    k = 0;
+    for(; filled < groups; filled++)
+    {
+        memcpy(grouped + filled * size, spill + k, size * sizeof(int));
+        k += size;
+    }
+
+    //Rank 0 is first on the first node, so it either starts some group or is
+    //the first processor left over.  In the first case swap that whole group
+    //into the front so nothing gets split up.
+    for(i = 0; i < compute && grouped[i] != 0; i++);
+    if(i < compute && i >= size)
+    {
+        for(j = 0; j < size; j++)
+        {
+            int tmp = grouped[j];
+            grouped[j] = grouped[i - i % size + j];
+            grouped[i - i % size + j] = tmp;
+        }
+    }
+
+    for(i = 0; i < groups; i++)
+    {
+        for(j = 0; j < size; j++)
+        {
+            if(rows)
+                place[i * hdiv + j] = grouped[i * size + j];
+            else
+                place[j * hdiv + i] = grouped[i * size + j];
+        }
+    }
+    for(i = compute; i < gsize; i++)
+        place[i] = spill[k++];
+
+    //Otherwise rank 0 was left over, and just trades places with slot 0
+    for(i = 0; place[i] != 0; i++);
+    if(i != 0)
+    {
+        place[i] = place[0];
+        place[0] = 0;
+    }
+
+    free(nodes);
+    free(order);
+    free(start);
+    free(grouped);
+    free(spill);
+}
+
+/*
+ * Logs how much of each transpose stays inside a node and how much has to go
+ * between nodes, added up over all the compute nodes for one forward
+ * transform.  The backward transform moves the same amounts.  Collective over
+ * all processors.
+ */
+void lab_reportTraffic()
+{
+    int i;
+    int * nodes = lab_nodeOf();
+
+    if(compute_node)
+    {
+        int * hpeers = (int*)malloc(hsize * sizeof(int));
+        int * vpeers = (int*)malloc(vsize * sizeof(int));
+        MPI_Allgather(&grank, 1, MPI_INT, hpeers, 1, MPI_INT, hcomm);
+        MPI_Allgather(&grank, 1, MPI_INT, vpeers, 1, MPI_INT, vcomm);
+
+        //[hcomm on node, hcomm off node, vcomm on node, vcomm off node]
+        double traffic[4] = {0, 0, 0, 0};
+        for(i = 0; i < hsize; i++)
+        {
+            if(i == hrank)
+                continue;
+            double sent = (double)all_ky[i].width * my_z->width * my_x->width;
+            traffic[nodes[hpeers[i]] == nodes[grank] ? 0 : 1] += sent;
+        }
+        for(i = 0; i < vsize; i++)
+        {
+            if(i == vrank)
+                continue;
+            double sent = (double)all_kx[i].width * my_ky->width * my_z->width;
+            traffic[nodes[vpeers[i]] == nodes[grank] ? 2 : 3] += sent;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, traffic, 4, MPI_DOUBLE, MPI_SUM, ccomm);
+
+        double mb = sizeof(complex PRECISION) / (1024.0 * 1024.0);
+        for(i = 0; i < 2; i++)
+        {
+            double total = traffic[2*i] + traffic[2*i+1];
+            info("%s transpose: %g MB within nodes, %g MB between nodes (%.1f%% within)\n", i == 0 ? "hcomm" : "vcomm",
+                traffic[2*i] * mb, traffic[2*i+1] * mb, total > 0 ? 100 * traffic[2*i] / total : 100.0);
+        }
+
+        free(hpeers);
+        free(vpeers);
+    }
+
+    free(nodes);
+}
+
 /*
  * Here we divide the computational domain among processors.  We define the
  * mapping of our 2D logical grid of compute nodes to our 3D grid of data, so
@@ -510,5 +859,18 @@ void lab_finalize()
     free(all_kx);
     free(all_ky);
     free(io_layers);
+
+    //Nodes outside of a group hold MPI_COMM_NULL.  The benchmark sets up and
+    //tears down many decompositions in one run, so these must not leak.
+    if(hcomm != MPI_COMM_NULL)
+        MPI_Comm_free(&hcomm);
+    if(vcomm != MPI_COMM_NULL)
+        MPI_Comm_free(&vcomm);
+    if(ccomm != MPI_COMM_NULL)
+        MPI_Comm_free(&ccomm);
+    if(fcomm != MPI_COMM_NULL)
+        MPI_Comm_free(&fcomm);
+    if(iocomm != MPI_COMM_NULL)
+        MPI_Comm_free(&iocomm);
 }
 
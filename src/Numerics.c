@@ -194,8 +194,6 @@ void testPT()
  */
 void decomposeSolenoidal(p_solenoid s, p_vector v, int force)
 {
-    //TODO: do some code duplication that will allow us to avoid checking
-    //for 0 wave modes every iteration of the loops
     int i,j,k;
     debug("Beginning decomposition of solenoidal field\n");
 
@@ -206,7 +204,6 @@ void decomposeSolenoidal(p_solenoid s, p_vector v, int force)
 
     debug("Calculating Poloidal field\n");
 
-    complex PRECISION dkx,dky,dkz;
     complex PRECISION * pz = v->z->spectral;
     complex PRECISION * py = v->y->spectral;
     complex PRECISION * px = v->x->spectral;
@@ -231,59 +228,68 @@ void decomposeSolenoidal(p_solenoid s, p_vector v, int force)
         ymean = s->mean_y;
     }
 
+    int nky = my_ky->width;
+    int columns = my_kx->width * nky;
 
-    int index = 0;
-    for(i = 0; i < my_kx->width; i++)
+    //P = -Az / (dx dx + dy dy), one [kx][ky] column at a time.  kh2Inv is 0
+    //for the horizontal mean, which is where P has to be 0.
+    #pragma omp parallel for private(k)
+    for(i = 0; i < columns; i++)
     {
-        dkx = dxFactor(i);
-        for(j = 0; j < my_ky->width; j++)
+        PRECISION kh = kh2Inv[i];
+        int index = i * ndkz;
+        for(k = 0; k < ndkz; k++)
+        {
+            ppol[index + k] = kh * pz[index + k];
+        }
+    }
+
+    debug("Calculating Toroidal Field\n");
+
+    //The kx = 0 plane only lives on the first row of processors.  There T
+    //comes from Ax instead, and the ky = 0 column of it is the mean flow.
+    int i0 = 0;
+    if(my_kx->min == 0)
+    {
+        int j0 = 0;
+        if(my_ky->min == 0)
         {
-            dky = dyFactor(j);
             for(k = 0; k < ndkz; k++)
             {
-                if((i+j+crank)==0)
-                    ppol[index] = 0;
-                else
-                    ppol[index] = -pz[index] / (dkx*dkx + dky*dky);
+                ptor[k] = 0;
+                xmean[k] = px[k];
+                ymean[k] = py[k];
+            }
+            j0 = 1;
+        }
 
-                index++;
+        for(j = j0; j < nky; j++)
+        {
+            PRECISION rky = -1 / kyTable[j];
+            int index = j * ndkz;
+            for(k = 0; k < ndkz; k++)
+            {
+                ptor[index + k] = iMul(rky, px[index + k]);
             }
         }
+        i0 = 1;
     }
 
-    debug("Calculating Toroidal Field\n");
-    index = 0;
-    for(i = 0; i < my_kx->width; i++)
+    //everything else we can find from the y field
+    #pragma omp parallel for private(j,k)
+    for(i = i0; i < my_kx->width; i++)
     {
-        dkx = dxFactor(i);
-        for(j = 0; j < my_ky->width; j++)
+        PRECISION rkx = 1 / kxTable[i];
+        for(j = 0; j < nky; j++)
         {
-            dky = dyFactor(j);
+            PRECISION ky = kyTable[j];
+            int index = (i * nky + j) * ndkz;
             for(k = 0; k < ndkz; k++)
             {
-                dkz = dzFactor(k);
-                if(i+j+crank == 0)
-                {
-                    ptor[index] = 0;
-                    xmean[k] = px[index];
-                    ymean[k] = py[index];
-
-                }
-                //functions of only y and z come from the x field
-                else if(i+vrank==0)
-                {
-                    ptor[index] = (px[index] - dkx * dkz * ppol[index])/dky;
-                }
-                //everything else we can find from y field
-                else
-                {
-                    ptor[index] = -(py[index] - dky * dkz * ppol[index])/dkx;
-                }
-                index++;
+                ptor[index + k] = iMul(rkx, py[index + k] + ky * kzTable[k] * ppol[index + k]);
             }
         }
     }
-
 }
 
 /*
@@ -301,8 +307,6 @@ void decomposeSolenoidal(p_solenoid s, p_vector v, int force)
  */
 void decomposeCurlSolenoidal(p_solenoid s, p_vector v, int force)
 {
-    //TODO: do some code duplication that will allow us to avoid checking
-    //for 0 wave modes every iteration of the loops
     int i,j,k;
     debug("Beginning decomposition of curled solenoidal field\n");
 
@@ -313,7 +317,6 @@ void decomposeCurlSolenoidal(p_solenoid s, p_vector v, int force)
 
     debug("Calculating Toroidal field\n");
 
-    complex PRECISION dkx,dky,dkz;
     complex PRECISION * pz = v->z->spectral;
     complex PRECISION * py = v->y->spectral;
     complex PRECISION * px = v->x->spectral;
@@ -337,71 +340,70 @@ void decomposeCurlSolenoidal(p_solenoid s, p_vector v, int force)
         ymean = s->mean_y;
     }
 
+    int nky = my_ky->width;
+    int columns = my_kx->width * nky;
 
-    int index = 0;
-    for(i = 0; i < my_kx->width; i++)
+    for(i = 0; i < columns; i++)
     {
-        dkx = dxFactor(i);
-        for(j = 0; j < my_ky->width; j++)
+        PRECISION kh = kh2Inv[i];
+        int index = i * ndkz;
+        for(k = 0; k < ndkz; k++)
         {
-            dky = dyFactor(j);
-            for(k = 0; k < ndkz; k++)
+            ptor[index + k] = kh * pz[index + k];
+        }
+    }
+
+    debug("Calculating Poloidal Field\n");
+
+    //as before, the kx = 0 plane comes from the x field
+    int i0 = 0;
+    if(my_kx->min == 0)
+    {
+        int j0 = 0;
+        if(my_ky->min == 0)
+        {
+            //something curled wont have a box mean
+            //Note: For most things this wont make a difference, but
+            //this implicitly means that you can't chose a forcing 
+            //that gives a variable a net acceleration upwards, 
+            //though it is unclear why that would be wanted in a
+            //periodic domain.
+            ppol[0] = 0;
+            xmean[0] = 0;
+            ymean[0] = 0;
+            for(k = 1; k < ndkz; k++)
             {
-                if((i+j+crank)==0)
-                    ptor[index] = 0;
-                else
-                    ptor[index] = -pz[index] / (dkx*dkx + dky*dky);
+                PRECISION rkz = 1 / kzTable[k];
+                ppol[k] = 0;
+                xmean[k] = iMul(-rkz, py[k]);
+                ymean[k] = iMul(rkz, px[k]);
+            }
+            j0 = 1;
+        }
 
-                index++;
+        for(j = j0; j < nky; j++)
+        {
+            PRECISION rky = -1 / kyTable[j];
+            int index = j * ndkz;
+            for(k = 0; k < ndkz; k++)
+            {
+                ppol[index + k] = iMul(rky * k2Inv[index + k], px[index + k]);
             }
         }
+        i0 = 1;
     }
 
-    debug("Calculating Poloidal Field\n");
-    index = 0;
-    for(i = 0; i < my_kx->width; i++)
+    //everything else we can find from y field
+    for(i = i0; i < my_kx->width; i++)
     {
-        dkx = dxFactor(i);
-        for(j = 0; j < my_ky->width; j++)
+        PRECISION rkx = 1 / kxTable[i];
+        for(j = 0; j < nky; j++)
         {
-            dky = dyFactor(j);
+            PRECISION ky = kyTable[j];
+            int index = (i * nky + j) * ndkz;
             for(k = 0; k < ndkz; k++)
             {
-                dkz = dzFactor(k);
-                if(i+j+crank == 0)
-                {
-                    ppol[index] = 0;
-                    if(k==0)
-                    {
-                        //something curled wont have a box mean
-                        //Note: For most things this wont make a difference, but
-                        //this implicitly means that you can't chose a forcing 
-                        //that gives a variable a net acceleration upwards, 
-                        //though it is unclear why that would be wanted in a
-                        //periodic domain.
-                        xmean[k] = 0;
-                        ymean[k] = 0;
-                        s->mean_z = 0;
-
-                    }
-                    else
-                    {
-                        xmean[k] = py[index] / dkz;
-                        ymean[k] = -px[index] / dkz;
-                    }
-
-                }
-                //functions of only y and z come from the x field
-                else if(i+vrank==0)
-                {
-                    ppol[index] = -px[index]/dky/(dkx*dkx + dky*dky + dkz*dkz);
-                }
-                //everything else we can find from y field
-                else
-                {
-                    ppol[index] = (py[index] - dky * dkz * ptor[index])/dkx/(dkx*dkx + dky*dky + dkz*dkz);
-                }
-                index++;
+                ppol[index + k] = iMul(rkx * k2Inv[index + k], py[index + k] + ky * kzTable[k] * ptor[index + k]);
             }
         }
     }
@@ -412,11 +414,12 @@ void decomposeCurlSolenoidal(p_solenoid s, p_vector v, int force)
  * directly use:
  * 
  * A  = < dx dz P + dy T, dy dz P - dx T, -(dx dx + dy dy)P >
+ * 
+ * and then put the means back in their column.
  */
 void recomposeSolenoidal(p_solenoid s, p_vector v)
 {
     int i,j,k;
-    complex PRECISION dkx,dky,dkz;
     complex PRECISION * pz = v->z->spectral;
     complex PRECISION * py = v->y->spectral;
     complex PRECISION * px = v->x->spectral;
@@ -428,27 +431,19 @@ void recomposeSolenoidal(p_solenoid s, p_vector v)
     int index = 0;
     for(i = 0; i < my_kx->width; i++)
     {
-        dkx = dxFactor(i);
+        PRECISION kx = kxTable[i];
         for(j = 0; j < my_ky->width; j++)
         {
-            dky = dyFactor(j);
+            PRECISION ky = kyTable[j];
+            PRECISION kh = kx * kx + ky * ky;
             for(k = 0; k < ndkz; k++)
             {
-                dkz = dzFactor(k);
+                PRECISION kz = kzTable[k];
 
-                if(i + j+ crank == 0)
-                {
-                    px[index] = xmean[k];
-                    py[index] = ymean[k];
-                }
-                else
-                {
-                    px[index] = dky * ptor[index] + dkx * dkz * ppol[index];
-                    py[index] = -dkx * ptor[index] + dky * dkz * ppol[index];
-                }
+                px[index] = iMul(ky, ptor[index]) - kx * kz * ppol[index];
+                py[index] = iMul(-kx, ptor[index]) - ky * kz * ppol[index];
+                pz[index] = kh * ppol[index];
 
-                pz[index] = -(dkx*dkx + dky*dky)*ppol[index];
-                
                 index++;
             }
         }
@@ -456,6 +451,11 @@ void recomposeSolenoidal(p_solenoid s, p_vector v)
 
     if(crank == 0)
     {
+        for(k = 0; k < ndkz; k++)
+        {
+            px[k] = xmean[k];
+            py[k] = ymean[k];
+        }
         v->z->spectral[0] = s->mean_z;
     }
 }
@@ -471,24 +471,30 @@ extern void laplacian(complex PRECISION * in, complex PRECISION * out, int add,
     trace("Starting Laplacian\n");
     
     int i,j,k;
-    int index = 0;
-    complex PRECISION dkx,dky,dkz;
+    int nky = my_ky->width;
 
+    #pragma omp parallel for private(j,k)
     for(i = 0; i < my_kx->width; i++)
     {
-        dkx = dxFactor(i);
-        for(j = 0; j < my_ky->width; j++)
+        PRECISION kx = kxTable[i];
+        for(j = 0; j < nky; j++)
         {
-            dky = dyFactor(j);
-            for(k = 0; k < ndkz; k++)
+            PRECISION ky = kyTable[j];
+            PRECISION kh = kx * kx + ky * ky;
+            int index = (i * nky + j) * ndkz;
+            if(add)
             {
-                dkz = dzFactor(k);
-                if(add)
-                    out[index] += factor * (dkx * dkx + dky * dky + dkz * dkz)*in[index];
-                else
-                    out[index] = factor * (dkx * dkx + dky * dky + dkz * dkz)*in[index];
-
-                index++;
+                for(k = 0; k < ndkz; k++)
+                {
+                    out[index + k] -= factor * (kh + kzTable[k] * kzTable[k]) * in[index + k];
+                }
+            }
+            else
+            {
+                for(k = 0; k < ndkz; k++)
+                {
+                    out[index + k] = -factor * (kh + kzTable[k] * kzTable[k]) * in[index + k];
+                }
             }
         }
     }
@@ -595,8 +601,7 @@ extern void killBoundaries(PRECISION * in, complex PRECISION * out, int add, PRE
 extern void curl(p_vector in, p_vector out)
 {
     int i,j,k;
-    complex PRECISION dkx, dky, dkz;
-    int index = 0;
+    int nky = my_ky->width;
 
     complex PRECISION * xin = in->x->spectral;
     complex PRECISION * yin = in->y->spectral;
@@ -606,20 +611,24 @@ extern void curl(p_vector in, p_vector out)
     complex PRECISION * yout = out->y->spectral;
     complex PRECISION * zout = out->z->spectral;
 
+    #pragma omp parallel for private(j,k)
     for(i = 0; i < my_kx->width; i++)
     {
-        dkx = dxFactor(i);
-        for(j = 0; j < my_ky->width; j++)
+        PRECISION kx = kxTable[i];
+        for(j = 0; j < nky; j++)
         {
-            dky = dyFactor(j);
+            PRECISION ky = kyTable[j];
+            int index = (i * nky + j) * ndkz;
             for(k = 0; k < ndkz; k++)
             {
-                dkz = dzFactor(k);
-                xout[index] = dky * zin[index] - dkz * yin[index];
-                yout[index] = dkz * xin[index] - dkx * zin[index];
-                zout[index] = dkx * yin[index] - dky * xin[index];
-
-                index++;
+                PRECISION kz = kzTable[k];
+                complex PRECISION x = xin[index + k];
+                complex PRECISION y = yin[index + k];
+                complex PRECISION z = zin[index + k];
+
+                xout[index + k] = iMul(ky, z) - iMul(kz, y);
+                yout[index + k] = iMul(kz, x) - iMul(kx, z);
+                zout[index + k] = iMul(kx, y) - iMul(ky, x);
             }
         }
     }
@@ -635,7 +644,6 @@ extern void curl(p_vector in, p_vector out)
 extern void gradient(p_field in, p_vector out)
 {
     int i,j,k;
-    complex PRECISION dkx, dky, dkz;
 
     complex PRECISION * pin = in->spectral;
     complex PRECISION * outx = out->x->spectral;
@@ -645,17 +653,17 @@ extern void gradient(p_field in, p_vector out)
     int index = 0;
     for(i = 0; i < my_kx->width; i++)
     {
-        dkx = dxFactor(i);
+        PRECISION kx = kxTable[i];
         for(j = 0; j < my_ky->width; j++)
         {
-            dky = dyFactor(j);
+            PRECISION ky = kyTable[j];
             for(k = 0; k < ndkz; k++)
             {
-                dkz = dzFactor(k);
+                complex PRECISION a = pin[index];
 
-                outx[index] = dkx * pin[index];
-                outy[index] = dky * pin[index];
-                outz[index] = dkz * pin[index];
+                outx[index] = iMul(kx, a);
+                outy[index] = iMul(ky, a);
+                outz[index] = iMul(kzTable[k], a);
 
                 index++;
             }
@@ -717,7 +725,6 @@ extern void crossProduct(p_vector one, p_vector two, p_vector out)
 extern void divergence(p_vector in, p_field out)
 {
     int i,j,k;
-    complex PRECISION dkx,dky,dkz;
     int index = 0;
 
     complex PRECISION * o = out->spectral;
@@ -726,17 +733,13 @@ extern void divergence(p_vector in, p_field out)
     complex PRECISION * z = in->z->spectral;
     for(i = 0; i < my_kx->width; i++)
     {
-        dkx = dxFactor(i);
+        PRECISION kx = kxTable[i];
         for(j = 0; j < my_ky->width; j++)
         {
-            dky = dyFactor(j);
+            PRECISION ky = kyTable[j];
             for(k = 0; k < ndkz; k++)
             {
-                dkz = dzFactor(k);
-
-                o[index] = dkx * x[index];
-                o[index] += dky * y[index];
-                o[index] += dkz * z[index];
+                o[index] = iMul(kx, x[index]) + iMul(ky, y[index]) + iMul(kzTable[k], z[index]);
 
                 index++;
             }
@@ -755,52 +758,48 @@ extern void divergence(p_vector in, p_field out)
  */
 extern void partialX(complex PRECISION * in, complex PRECISION * out, int arithmetic)
 {
-    int i,j,k;
-    int index = 0;
-    complex PRECISION dk;
+    int i,j;
+    int plane = my_ky->width * ndkz;
 
     if(arithmetic == 0)
     {
+        #pragma omp parallel for private(j)
         for(i = 0; i < my_kx->width; i++)
         {
-            dk = dxFactor(i);
-            for(j = 0; j < my_ky->width; j++)
+            PRECISION dk = kxTable[i];
+            complex PRECISION * pin = in + i * plane;
+            complex PRECISION * pout = out + i * plane;
+            for(j = 0; j < plane; j++)
             {
-                for(k = 0; k < ndkz; k++)
-                {
-                    out[index] = dk*in[index];
-                    index++;
-                }
+                pout[j] = iMul(dk, pin[j]);
             }
         }
     }
     else if(arithmetic == 1)
     {
+        #pragma omp parallel for private(j)
         for(i = 0; i < my_kx->width; i++)
         {
-            dk = dxFactor(i);
-            for(j = 0; j < my_ky->width; j++)
+            PRECISION dk = kxTable[i];
+            complex PRECISION * pin = in + i * plane;
+            complex PRECISION * pout = out + i * plane;
+            for(j = 0; j < plane; j++)
             {
-                for(k = 0; k < ndkz; k++)
-                {
-                    out[index] += dk*in[index];
-                    index++;
-                }
+                pout[j] += iMul(dk, pin[j]);
             }
         }
     }
     else if(arithmetic == 2)
     {
+        #pragma omp parallel for private(j)
         for(i = 0; i < my_kx->width; i++)
         {
-            dk = dxFactor(i);
-            for(j = 0; j < my_ky->width; j++)
+            PRECISION dk = kxTable[i];
+            complex PRECISION * pin = in + i * plane;
+            complex PRECISION * pout = out + i * plane;
+            for(j = 0; j < plane; j++)
             {
-                for(k = 0; k < ndkz; k++)
-                {
-                    out[index] -= dk*in[index];
-                    index++;
-                }
+                pout[j] -= iMul(dk, pin[j]);
             }
         }
     }
@@ -821,50 +820,51 @@ extern void partialX(complex PRECISION * in, complex PRECISION * out, int arithm
 extern void partialY(complex PRECISION * in, complex PRECISION * out, int arithmetic)
 {
     int i,j,k;
-    int index = 0;
-    complex PRECISION dk;
 
     if(arithmetic == 0)
     {
+        #pragma omp parallel for private(j,k)
         for(i = 0; i < my_kx->width; i++)
         {
             for(j = 0; j < my_ky->width; j++)
             {
-                dk = dyFactor(j);
+                PRECISION dk = kyTable[j];
+                int index = (i * my_ky->width + j) * ndkz;
                 for(k = 0; k < ndkz; k++)
                 {
-                    out[index] = dk*in[index];
-                    index++;
+                    out[index + k] = iMul(dk, in[index + k]);
                 }
             }
         }
     }
     else if(arithmetic == 1)
     {
+        #pragma omp parallel for private(j,k)
         for(i = 0; i < my_kx->width; i++)
         {
             for(j = 0; j < my_ky->width; j++)
             {
-                dk = dyFactor(j);
+                PRECISION dk = kyTable[j];
+                int index = (i * my_ky->width + j) * ndkz;
                 for(k = 0; k < ndkz; k++)
                 {
-                    out[index] += dk*in[index];
-                    index++;
+                    out[index + k] += iMul(dk, in[index + k]);
                 }
             }
         }
     }
     else if(arithmetic == 2)
     {
+        #pragma omp parallel for private(j,k)
         for(i = 0; i < my_kx->width; i++)
         {
             for(j = 0; j < my_ky->width; j++)
             {
-                dk = dyFactor(j);
+                PRECISION dk = kyTable[j];
+                int index = (i * my_ky->width + j) * ndkz;
                 for(k = 0; k < ndkz; k++)
                 {
-                    out[index] -= dk*in[index];
-                    index++;
+                    out[index + k] -= iMul(dk, in[index + k]);
                 }
             }
         }
@@ -886,50 +886,48 @@ extern void partialY(complex PRECISION * in, complex PRECISION * out, int arithm
 extern void partialZ(complex PRECISION * in, complex PRECISION * out, int arithmetic)
 {
     int i,j,k;
-    int index = 0;
-    complex PRECISION dk;
 
     if(arithmetic == 0)
     {
+        #pragma omp parallel for private(j,k)
         for(i = 0; i < my_kx->width; i++)
         {
             for(j = 0; j < my_ky->width; j++)
             {
+                int index = (i * my_ky->width + j) * ndkz;
                 for(k = 0; k < ndkz; k++)
                 {
-                    dk = dzFactor(k);
-                    out[index] = dk*in[index];
-                    index++;
+                    out[index + k] = iMul(kzTable[k], in[index + k]);
                 }
             }
         }
     }
     else if(arithmetic == 1)
     {
+        #pragma omp parallel for private(j,k)
         for(i = 0; i < my_kx->width; i++)
         {
             for(j = 0; j < my_ky->width; j++)
             {
+                int index = (i * my_ky->width + j) * ndkz;
                 for(k = 0; k < ndkz; k++)
                 {
-                    dk = dzFactor(k);
-                    out[index] += dk*in[index];
-                    index++;
+                    out[index + k] += iMul(kzTable[k], in[index + k]);
                 }
             }
         }
     }
     else if(arithmetic == 2)
     {
+        #pragma omp parallel for private(j,k)
         for(i = 0; i < my_kx->width; i++)
         {
             for(j = 0; j < my_ky->width; j++)
             {
+                int index = (i * my_ky->width + j) * ndkz;
                 for(k = 0; k < ndkz; k++)
                 {
-                    dk = dzFactor(k);
-                    out[index] -= dk*in[index];
-                    index++;
+                    out[index + k] -= iMul(kzTable[k], in[index + k]);
                 }
             }
         }
@@ -1030,6 +1028,51 @@ extern complex PRECISION dzFactor(int i)
     return I * 2 * PI * k / zmx;
 }
 
+/*
+ * Builds the wavenumber tables for this processor's part of the spectral
+ * arrays.  Anything left over from a previous distribution is thrown out
+ * first.
+ */
+void initWavenumbers()
+{
+    int i,j,k;
+    int nky = my_ky->width;
+
+    free(kxTable);
+    free(kyTable);
+    free(kzTable);
+    free(kh2Inv);
+    free(k2Inv);
+    kxTable = (PRECISION*)malloc(my_kx->width * sizeof(PRECISION));
+    kyTable = (PRECISION*)malloc(nky * sizeof(PRECISION));
+    kzTable = (PRECISION*)malloc(ndkz * sizeof(PRECISION));
+    kh2Inv = (PRECISION*)malloc(my_kx->width * nky * sizeof(PRECISION));
+    k2Inv = (PRECISION*)malloc(spectralCount * sizeof(PRECISION));
+
+    for(i = 0; i < my_kx->width; i++)
+        kxTable[i] = cimag(dxFactor(i));
+    for(j = 0; j < nky; j++)
+        kyTable[j] = cimag(dyFactor(j));
+    for(k = 0; k < ndkz; k++)
+        kzTable[k] = cimag(dzFactor(k));
+
+    int index = 0;
+    for(i = 0; i < my_kx->width; i++)
+    {
+        for(j = 0; j < nky; j++)
+        {
+            PRECISION kh = kxTable[i] * kxTable[i] + kyTable[j] * kyTable[j];
+            kh2Inv[i * nky + j] = kh == 0 ? 0 : 1 / kh;
+            for(k = 0; k < ndkz; k++)
+            {
+                PRECISION k2 = kh + kzTable[k] * kzTable[k];
+                k2Inv[index] = k2 == 0 ? 0 : 1 / k2;
+                index++;
+            }
+        }
+    }
+}
+
 /*
  * This routine shifts a given field f by a given displacement d.  This is done
  * by changing the phase of each wavemode appropriately.  This method works, but
@@ -25,6 +25,7 @@
 #include "Environment.h"
 #include "Field.h"
 #include "TimeFunctions.h"
+#include "Profile.h"
 
 #include <string.h>
 #include <math.h>
@@ -43,6 +44,41 @@ void step();
 void eulerStep();
 void AB2Step();
 void AB3Step();
+void multistep(int order, PRECISION * c);
+void abArray(complex PRECISION * func, complex PRECISION * f1, complex PRECISION * f2, complex PRECISION * f3, int order, PRECISION * c, PRECISION nu, int mean);
+void rkStep();
+void rkStage(PRECISION a, PRECISION b, PRECISION frac);
+void rkArray(complex PRECISION * func, complex PRECISION * F, complex PRECISION * q, PRECISION a, PRECISION b, PRECISION frac, PRECISION nu, int mean);
+void updateState();
+
+/*
+ * Coefficients for the low storage Runge-Kutta schemes, in the 2N form of
+ * Williamson (1980).  Stage s sets q = A[s] q + dt F and then moves the state
+ * by B[s] q, with F found at time t + c[s] dt.
+ * 
+ * RK3 is Williamson's third order scheme, and RK4 is the five stage fourth
+ * order scheme of Carpenter and Kennedy (1994), which reaches further along
+ * the imaginary axis and so lets advection take larger steps.
+ */
+static const PRECISION rk3A[3] = {0.0, -5.0/9.0, -153.0/128.0};
+static const PRECISION rk3B[3] = {1.0/3.0, 15.0/16.0, 8.0/15.0};
+static const PRECISION rk3C[3] = {0.0, 1.0/3.0, 3.0/4.0};
+
+static const PRECISION rk4A[5] = {0.0,
+                                  -567301805773.0/1357537059087.0,
+                                  -2404267990393.0/2016746695238.0,
+                                  -3550918686646.0/2091501179385.0,
+                                  -1275806237668.0/842570457699.0};
+static const PRECISION rk4B[5] = {1432997174477.0/9575080441755.0,
+                                  5161836677717.0/13612068292357.0,
+                                  1720146321549.0/2090206949498.0,
+                                  3134564353537.0/4481467310338.0,
+                                  2277821191437.0/14882151754819.0};
+static const PRECISION rk4C[5] = {0.0,
+                                  1432997174477.0/9575080441755.0,
+                                  2526269341429.0/6820363962896.0,
+                                  2006345519317.0/3224310063776.0,
+                                  2802321613138.0/2924317926251.0};
 
 /* 
  * This is one of the few methods available externally.  Here we simply 
@@ -51,9 +87,22 @@ void AB3Step();
  */
 void iterate()
 {
+    prof_start(PROF_TIMESTEP);
     calcNewTimestep();
-    calcForces();
-    step();
+    prof_stop(PROF_TIMESTEP);
+
+    if(integrator == INTEGRATE_AB3)
+    {
+        calcForces();
+
+        prof_start(PROF_INTEGRATE);
+        step();
+        prof_stop(PROF_INTEGRATE);
+    }
+    else
+    {
+        rkStep();
+    }
 
     /*
      * This is an experimental and only partially functional attempt to recenter
@@ -109,28 +158,41 @@ void iterate()
             shiftField(d, T->force2);
         }
     }
-    
-    //make sure our state variables are up to date, both spectral and spatial
+
+    updateState();
+}
+
+/*
+ * Brings the spatial state variables up to date with the spectral ones, so
+ * that the next force evaluation sees the new state.  All of the state
+ * variables go through one batched transform.
+ */
+void updateState()
+{
+    p_field state[7];
+    int nstate = 0;
     if(momEquation)
     {
         recomposeSolenoidal(u->sol, u->vec);
-        fftBackward(u->vec->x);
-        fftBackward(u->vec->y);
-        fftBackward(u->vec->z);
+        state[nstate++] = u->vec->x;
+        state[nstate++] = u->vec->y;
+        state[nstate++] = u->vec->z;
     }
 
     if(magEquation)
     {
         recomposeSolenoidal(B->sol, B->vec);
-        fftBackward(B->vec->x);
-        fftBackward(B->vec->y);
-        fftBackward(B->vec->z);
+        state[nstate++] = B->vec->x;
+        state[nstate++] = B->vec->y;
+        state[nstate++] = B->vec->z;
     }
 
     if(tEquation)
     {
-        fftBackward(T);
+        state[nstate++] = T;
     }
+
+    fftBackwardBatch(state, nstate);
 }
 
 /*
@@ -143,7 +205,8 @@ void iterate()
  * 
  * 1.   The diffusion timescale in the x direction with a diffusion coefficient
  *      of D is dx**2 / D.  For each diffusion term in the problem, the most 
- *      restrictive dt is chosen.
+ *      restrictive dt is chosen.  This only applies when diffusion is
+ *      explicit, as the other methods in abArray are stable for any dt.
  * 
  * 2.   For advection terms, we simply ensure that when using the peak 
  *      velocities in the problem, a passive tracer particle cannot move from
@@ -166,18 +229,19 @@ void calcNewTimestep()
                 //of the following cases.
 
     PRECISION min_d2 = pow(fmin(fmin(dx,dy),dz),2);
+    int explicitDiff = diffusionMethod == DIFFUSE_EXPLICIT;
     
-    if(momEquation && viscosity)
+    if(momEquation && viscosity && explicitDiff)
     {
         dt = safetyFactor * min_d2 / Pr;
     }
-    if(tEquation && tDiff)
+    if(tEquation && tDiff && explicitDiff)
     {
         PRECISION temp = safetyFactor * min_d2;
         if(temp < dt)
             dt = temp;
     }
-    if(magEquation && magDiff)
+    if(magEquation && magDiff && explicitDiff)
     {
         PRECISION temp = safetyFactor * min_d2 * Pm / Pr;
         if(temp < dt)
@@ -240,9 +304,11 @@ void calcForces()
 {
     debug("Calculating forces\n");
 
-    //cycle the force pointers for any active equation.
+    //cycle the force pointers for any active equation.  Runge-Kutta keeps no
+    //past forces, so force1 is simply overwritten each stage.
     complex PRECISION * temp;
-    if(momEquation)
+    int cycle = integrator == INTEGRATE_AB3;
+    if(momEquation && cycle)
     {
         temp = u->sol->poloidal->force3;
         u->sol->poloidal->force3 = u->sol->poloidal->force2;
@@ -265,7 +331,7 @@ void calcForces()
         u->sol->mean_yf1 = temp;
     }
 
-    if(magEquation)
+    if(magEquation && cycle)
     {
         temp = B->sol->poloidal->force3;
         B->sol->poloidal->force3 = B->sol->poloidal->force2;
@@ -288,7 +354,7 @@ void calcForces()
         B->sol->mean_yf1 = temp;
     }
 
-    if(tEquation)
+    if(tEquation && cycle)
     {
         temp = T->force3;
         T->force3 = T->force2;
@@ -298,17 +364,217 @@ void calcForces()
 
     //real force calculations are in these methods.
     if(momEquation)
+    {
+        prof_start(PROF_MOMENTUM);
         calcMomentum();
+        prof_stop(PROF_MOMENTUM);
+    }
 
     if(tEquation)
+    {
+        prof_start(PROF_TEMP);
         calcTemp();
+        prof_stop(PROF_TEMP);
+    }
 
     if(magEquation)
+    {
+        prof_start(PROF_MAG);
         calcMag();
+        prof_stop(PROF_MAG);
+    }
    
     debug("Forces done\n");
 }
 
+/*
+ * Everything that goes into the momentum force, for momentumKernel.  Any
+ * pointer may be 0 if that term is off.
+ */
+typedef struct
+{
+    complex PRECISION * stress[6];  //xx, yy, zz, xy, xz, yz of alpha BB - uu
+    complex PRECISION * body[3];    //any other force, already transformed
+    complex PRECISION * bz;         //extra vertical force, times bzScale
+    complex PRECISION * vel[3];     //velocity, for explicit viscosity
+    complex PRECISION * stat;       //static forcing in x
+    complex PRECISION * temp;       //temperature, for buoyancy
+    PRECISION bzScale;
+} momentumTerms;
+
+/*
+ * The momentum force for the mode at index, which has wavenumber (kx,ky,kz).
+ */
+static inline void momentumForce(const momentumTerms * m, int index, PRECISION kx, PRECISION ky, PRECISION kz, complex PRECISION * f)
+{
+    f[0] = 0;
+    f[1] = 0;
+    f[2] = 0;
+
+    if(m->vel[0])
+    {
+        PRECISION d = -Pr * (kx * kx + ky * ky + kz * kz);
+        f[0] = d * m->vel[0][index];
+        f[1] = d * m->vel[1][index];
+        f[2] = d * m->vel[2][index];
+    }
+    if(m->stat)
+    {
+        f[0] += m->stat[index];
+    }
+    if(m->body[0])
+    {
+        f[0] += m->body[0][index];
+        f[1] += m->body[1][index];
+        f[2] += m->body[2][index];
+    }
+    if(m->bz)
+    {
+        f[2] += m->bzScale * m->bz[index];
+    }
+    if(m->temp)
+    {
+        f[2] += Ra * Pr * m->temp[index];
+    }
+    if(m->stress[0])
+    {
+        complex PRECISION * const * s = m->stress;
+        f[0] += iMul(kx, s[0][index]) + iMul(ky, s[3][index]) + iMul(kz, s[4][index]);
+        f[1] += iMul(kx, s[3][index]) + iMul(ky, s[1][index]) + iMul(kz, s[5][index]);
+        f[2] += iMul(kx, s[4][index]) + iMul(ky, s[5][index]) + iMul(kz, s[2][index]);
+    }
+}
+
+/*
+ * Finds the momentum force, takes its curl to get rid of the pressure, and
+ * splits that into the poloidal and toroidal forces for u, all one mode at a
+ * time.  This is the same as building the force in a vector and handing its
+ * curl to decomposeCurlSolenoidal, which is spelled out there, without
+ * writing any of the intermediate vectors.  With add the result is added to
+ * the forces rather than overwriting them.
+ * 
+ * The horizontal means are easier than they look in decomposeCurlSolenoidal,
+ * as there the x and y mean forces are just the x and y force.
+ */
+static void momentumKernel(const momentumTerms * m, int add)
+{
+    int i,j,k;
+    int nky = my_ky->width;
+    complex PRECISION f[3];
+
+    p_solenoid s = u->sol;
+    complex PRECISION * ppol = s->poloidal->force1;
+    complex PRECISION * ptor = s->toroidal->force1;
+    complex PRECISION * xmean = s->mean_xf1;
+    complex PRECISION * ymean = s->mean_yf1;
+
+    if(crank == 0)
+    {
+        s->mean_z = 0;
+    }
+
+    //The kx = 0 plane only lives on the first row of processors, and has the
+    //horizontal means in its ky = 0 column
+    int i0 = 0;
+    if(my_kx->min == 0)
+    {
+        int j0 = 0;
+        if(my_ky->min == 0)
+        {
+            for(k = 0; k < ndkz; k++)
+            {
+                momentumForce(m, k, 0, 0, kzTable[k], f);
+
+                //something curled wont have a box mean
+                if(k == 0)
+                {
+                    f[0] = 0;
+                    f[1] = 0;
+                }
+
+                if(add)
+                {
+                    xmean[k] += f[0];
+                    ymean[k] += f[1];
+                }
+                else
+                {
+                    ppol[k] = 0;
+                    ptor[k] = 0;
+                    xmean[k] = f[0];
+                    ymean[k] = f[1];
+                }
+            }
+            j0 = 1;
+        }
+
+        for(j = j0; j < nky; j++)
+        {
+            PRECISION ky = kyTable[j];
+            PRECISION kh = kh2Inv[j];
+            PRECISION rky = -1 / ky;
+            int index = j * ndkz;
+            for(k = 0; k < ndkz; k++)
+            {
+                PRECISION kz = kzTable[k];
+                momentumForce(m, index, 0, ky, kz, f);
+
+                complex PRECISION cx = iMul(ky, f[2]) - iMul(kz, f[1]);
+                complex PRECISION tor = kh * iMul(-ky, f[0]);
+                complex PRECISION pol = iMul(rky * k2Inv[index], cx);
+
+                if(add)
+                {
+                    ptor[index] += tor;
+                    ppol[index] += pol;
+                }
+                else
+                {
+                    ptor[index] = tor;
+                    ppol[index] = pol;
+                }
+                index++;
+            }
+        }
+        i0 = 1;
+    }
+
+    #pragma omp parallel for private(j,k,f)
+    for(i = i0; i < my_kx->width; i++)
+    {
+        PRECISION kx = kxTable[i];
+        PRECISION rkx = 1 / kx;
+        for(j = 0; j < nky; j++)
+        {
+            PRECISION ky = kyTable[j];
+            PRECISION kh = kh2Inv[i * nky + j];
+            int index = (i * nky + j) * ndkz;
+            for(k = 0; k < ndkz; k++)
+            {
+                PRECISION kz = kzTable[k];
+                momentumForce(m, index, kx, ky, kz, f);
+
+                complex PRECISION cy = iMul(kz, f[0]) - iMul(kx, f[2]);
+                complex PRECISION cz = iMul(kx, f[1]) - iMul(ky, f[0]);
+                complex PRECISION tor = kh * cz;
+                complex PRECISION pol = iMul(rkx * k2Inv[index], cy + ky * kz * tor);
+
+                if(add)
+                {
+                    ptor[index] += tor;
+                    ppol[index] += pol;
+                }
+                else
+                {
+                    ptor[index] = tor;
+                    ppol[index] = pol;
+                }
+                index++;
+            }
+        }
+    }
+}
+
 /*
  * This routine is in charge of the momentum equation.  Virtually all
  * of the terms can be enabled or disabled by parameters read in through the
@@ -320,184 +586,231 @@ void calcForces()
  * and is eliminated by taking the curl of the right-hand side.  This is then
  * decomposed into poloidal and toroidal components, which are then used in the
  * time integration.
+ * 
+ * All of that happens in momentumKernel, in one sweep over the spectral modes.
+ * alpha BB - uu is put together in spatial coordinates, so advection and the
+ * Lorentz force need only six transforms between them.  The rarely used time
+ * dependent forcing, magnetic buoyancy and boundary sanitizing need temp1 and
+ * temp2 as well, so they get a sweep of their own first.
+ * 
+ * With nonlinearForm set to rotational, advection and the Lorentz force are
+ * instead found from
+ * 
+ * -div(uu) + alpha div(BB) = u x w + alpha j x B + grad(alpha B^2 - u^2)/2
+ * 
+ * where the gradient is dropped, as the curl removes it anyway.  This takes
+ * only three forward transforms, but the vorticity w and the current j have to
+ * be transformed back first.
  */
 void calcMomentum()
 {
     debug("Calculating momentum forces\n");
 
-    int i,j,k;
-    int index;
+    int i;
+    int add = 0;
 
-    if(viscosity)
-    {
-        //First argument is the field we take the laplacian of.
-        //Second argument is where the result is stored.
-        //The 0 in the third argument means we overwrite the destination array
-        //Pr is the coefficient for this diffusion term.
-        laplacian(u->vec->x->spectral, rhs->x->spectral, 0, Pr);
-        laplacian(u->vec->y->spectral, rhs->y->spectral, 0, Pr);
-        laplacian(u->vec->z->spectral, rhs->z->spectral, 0, Pr);
-    }
-    else
-    {
-        //make sure we don't start with garbage
-        memset(rhs->x->spectral, 0, spectralCount * sizeof(complex PRECISION));
-        memset(rhs->y->spectral, 0, spectralCount * sizeof(complex PRECISION));
-        memset(rhs->z->spectral, 0, spectralCount * sizeof(complex PRECISION));
-    }
-    
-    //Apply hyper diffusion to the boundaries
-    //This does not currently work and is disabled by default!
-    if(sanitize)
+    momentumTerms m;
+    memset(&m, 0, sizeof(momentumTerms));
+
+    //Unless it is explicit, diffusion is left to the time integration (see
+    //abArray)
+    if(viscosity && diffusionMethod == DIFFUSE_EXPLICIT)
     {
-        killBoundaries(u->vec->x->spatial, rhs->x->spectral, 1, 100*Pr);
-        killBoundaries(u->vec->y->spatial, rhs->y->spectral, 1, 100*Pr);
-        killBoundaries(u->vec->z->spatial, rhs->z->spectral, 1, 100*Pr);
+        m.vel[0] = u->vec->x->spectral;
+        m.vel[1] = u->vec->y->spectral;
+        m.vel[2] = u->vec->z->spectral;
     }
 
     //static forcing is read in from a file and currently only in the u 
     //direction as a function of y and z (to remove nonlinear advection)
     if(momStaticForcing)
     {
-        complex PRECISION * xfield = rhs->x->spectral;
-        complex PRECISION * ffield = forceField->spectral;
-        index = 0;
-        for(i = 0; i < spectralCount; i++)
-        {
-            xfield[i] += ffield[i];
-        }
+        m.stat = forceField->spectral;
     }
 
-    //
-    if(momTimeForcing)
+    if(buoyancy)
     {
-        //Evaluate the force function at the current time.
-        fillTimeField(temp1, MOMENTUM);
-
-        plusEq(rhs->x->spectral, temp1->x->spectral);
-        plusEq(rhs->y->spectral, temp1->y->spectral);
-        plusEq(rhs->z->spectral, temp1->z->spectral);
+        m.temp = T->spectral;
     }
 
-    
-    if(momAdvection)
+    if(momTimeForcing || magBuoy || sanitize)
     {
-        p_field tense = temp1->x;
-
-	    //Note here, because I already forgot once.  a 2 as the third
-	    //parameter makes things behave as a -= operation!
-        multiply(u->vec->x->spatial, u->vec->x->spatial, tense->spatial);
-        fftForward(tense);
-        partialX(tense->spectral, rhs->x->spectral, 2);
-
-        multiply(u->vec->y->spatial, u->vec->y->spatial, tense->spatial);
-        fftForward(tense);
-        partialY(tense->spectral, rhs->y->spectral, 2);
-
-        multiply(u->vec->z->spatial, u->vec->z->spatial, tense->spatial);
-        fftForward(tense);
-        partialZ(tense->spectral, rhs->z->spectral, 2);
-
-        multiply(u->vec->x->spatial, u->vec->y->spatial, tense->spatial);
-        fftForward(tense);
-        partialY(tense->spectral, rhs->x->spectral, 2);
-        partialX(tense->spectral, rhs->y->spectral, 2);
-
-        multiply(u->vec->x->spatial, u->vec->z->spatial, tense->spatial);
-        fftForward(tense);
-        partialZ(tense->spectral, rhs->x->spectral, 2);
-        partialX(tense->spectral, rhs->z->spectral, 2);
-
-        multiply(u->vec->y->spatial, u->vec->z->spatial, tense->spatial);
-        fftForward(tense);
-        partialZ(tense->spectral, rhs->y->spectral, 2);
-        partialY(tense->spectral, rhs->z->spectral, 2);      
-    }
+        if(momTimeForcing || sanitize)
+        {
+            if(momTimeForcing)
+            {
+                //Evaluate the force function at the current time.
+                fillTimeField(temp1, MOMENTUM);
+            }
+            else
+            {
+                memset(temp1->x->spectral, 0, spectralCount * sizeof(complex PRECISION));
+                memset(temp1->y->spectral, 0, spectralCount * sizeof(complex PRECISION));
+                memset(temp1->z->spectral, 0, spectralCount * sizeof(complex PRECISION));
+            }
+
+            //Apply hyper diffusion to the boundaries
+            //This does not currently work and is disabled by default!
+            if(sanitize)
+            {
+                killBoundaries(u->vec->x->spatial, temp1->x->spectral, 1, 100*Pr);
+                killBoundaries(u->vec->y->spatial, temp1->y->spectral, 1, 100*Pr);
+                killBoundaries(u->vec->z->spatial, temp1->z->spectral, 1, 100*Pr);
+            }
+
+            m.body[0] = temp1->x->spectral;
+            m.body[1] = temp1->y->spectral;
+            m.body[2] = temp1->z->spectral;
+        }
 
+        if(magBuoy)
+        {
+            p_field B2 = temp2->x;
+            dotProduct(B->vec,B->vec,B2);
+            fftForward(B2);
+            m.bz = B2->spectral;
+            m.bzScale = magBuoyScale;
+        }
+
+        //everything but the stress, which needs temp1 and temp2 for itself
+        momentumKernel(&m, 0);
+        memset(&m, 0, sizeof(momentumTerms));
+        add = 1;
+    }
 
-    if(lorentz)
+    if((momAdvection || lorentz) && nonlinearForm == NONLINEAR_ROTATIONAL)
     {
-        p_field tense = temp1->x;
-        p_vector lor = temp2;
+        //The vorticity and current come from the spectral state, in one
+        //batch of backward transforms
+        p_field curls[6];
+        int ncurls = 0;
+        if(momAdvection)
+        {
+            curl(u->vec, temp1);
+            curls[ncurls++] = temp1->x;
+            curls[ncurls++] = temp1->y;
+            curls[ncurls++] = temp1->z;
+        }
+        if(lorentz)
+        {
+            curl(B->vec, temp2);
+            curls[ncurls++] = temp2->x;
+            curls[ncurls++] = temp2->y;
+            curls[ncurls++] = temp2->z;
+        }
+        fftBackwardBatch(curls, ncurls);
+
+        //u x w + alpha j x B, built on top of the vorticity
+        PRECISION * nx = temp1->x->spatial;
+        PRECISION * ny = temp1->y->spatial;
+        PRECISION * nz = temp1->z->spatial;
+        PRECISION * ux = u->vec->x->spatial;
+        PRECISION * uy = u->vec->y->spatial;
+        PRECISION * uz = u->vec->z->spatial;
+        if(momAdvection)
+        {
+            for(i = 0; i < spatialCount; i++)
+            {
+                PRECISION wx = nx[i];
+                PRECISION wy = ny[i];
+                PRECISION wz = nz[i];
+                nx[i] = uy[i] * wz - uz[i] * wy;
+                ny[i] = uz[i] * wx - ux[i] * wz;
+                nz[i] = ux[i] * wy - uy[i] * wx;
+            }
+        }
+        else
+        {
+            memset(nx, 0, spatialCount * sizeof(PRECISION));
+            memset(ny, 0, spatialCount * sizeof(PRECISION));
+            memset(nz, 0, spatialCount * sizeof(PRECISION));
+        }
 
-        //The third parameter as a 0 means we overwrite the destination array.
-        //The third parameter as a 1 means it behaves as a += operation.
-        
-        multiply(B->vec->x->spatial, B->vec->x->spatial, tense->spatial);
-        fftForward(tense);
-        partialX(tense->spectral, lor->x->spectral, 0);
-
-        multiply(B->vec->y->spatial, B->vec->y->spatial, tense->spatial);
-        fftForward(tense);
-        partialY(tense->spectral, lor->y->spectral, 0);
-
-        multiply(B->vec->z->spatial, B->vec->z->spatial, tense->spatial);
-        fftForward(tense);
-        partialZ(tense->spectral, lor->z->spectral, 0);
-
-        multiply(B->vec->x->spatial, B->vec->y->spatial, tense->spatial);
-        fftForward(tense);
-        partialY(tense->spectral, lor->x->spectral, 1);
-        partialX(tense->spectral, lor->y->spectral, 1);
-
-        multiply(B->vec->x->spatial, B->vec->z->spatial, tense->spatial);
-        fftForward(tense);
-        partialZ(tense->spectral, lor->x->spectral, 1);
-        partialX(tense->spectral, lor->z->spectral, 1);
-
-        multiply(B->vec->y->spatial, B->vec->z->spatial, tense->spatial);
-        fftForward(tense);
-        partialZ(tense->spectral, lor->y->spectral, 1);
-        partialY(tense->spectral, lor->z->spectral, 1);
-
-        //TODO: Find a routine to change to include this factor
-        complex PRECISION * px = lor->x->spectral;
-        complex PRECISION * py = lor->y->spectral;
-        complex PRECISION * pz = lor->z->spectral;
-        int i;
-        for(i = 0; i < spectralCount; i++)
+        if(lorentz)
         {
-            px[i] *= alpha;
-            py[i] *= alpha;
-            pz[i] *= alpha;
+            PRECISION * jx = temp2->x->spatial;
+            PRECISION * jy = temp2->y->spatial;
+            PRECISION * jz = temp2->z->spatial;
+            PRECISION * bx = B->vec->x->spatial;
+            PRECISION * by = B->vec->y->spatial;
+            PRECISION * bz = B->vec->z->spatial;
+            for(i = 0; i < spatialCount; i++)
+            {
+                nx[i] += alpha * (jy[i] * bz[i] - jz[i] * by[i]);
+                ny[i] += alpha * (jz[i] * bx[i] - jx[i] * bz[i]);
+                nz[i] += alpha * (jx[i] * by[i] - jy[i] * bx[i]);
+            }
         }
 
-        plusEq(rhs->x->spectral, px);
-        plusEq(rhs->y->spectral, py);
-        plusEq(rhs->z->spectral, pz);
+        p_field nl[3] = {temp1->x, temp1->y, temp1->z};
+        fftForwardBatch(nl, 3);
+
+        m.body[0] = temp1->x->spectral;
+        m.body[1] = temp1->y->spectral;
+        m.body[2] = temp1->z->spectral;
     }
-    
-    if(magBuoy)
+    else if(momAdvection || lorentz)
     {
-        p_field B2 = temp1->x;
-        dotProduct(B->vec,B->vec,B2);
-        fftForward(B2);
-        for(i = 0; i < spectralCount; i++)
+        //Each of the six components of the stress tensor gets its own trash
+        //field so they can all be transformed in a single batch
+        p_field tense[6] = {temp1->x, temp1->y, temp1->z, temp2->x, temp2->y, temp2->z};
+        PRECISION * sxx = tense[0]->spatial;
+        PRECISION * syy = tense[1]->spatial;
+        PRECISION * szz = tense[2]->spatial;
+        PRECISION * sxy = tense[3]->spatial;
+        PRECISION * sxz = tense[4]->spatial;
+        PRECISION * syz = tense[5]->spatial;
+
+        if(momAdvection)
         {
-            B2->spectral[i] *= magBuoyScale;
+            PRECISION * ux = u->vec->x->spatial;
+            PRECISION * uy = u->vec->y->spatial;
+            PRECISION * uz = u->vec->z->spatial;
+            for(i = 0; i < spatialCount; i++)
+            {
+                sxx[i] = -ux[i] * ux[i];
+                syy[i] = -uy[i] * uy[i];
+                szz[i] = -uz[i] * uz[i];
+                sxy[i] = -ux[i] * uy[i];
+                sxz[i] = -ux[i] * uz[i];
+                syz[i] = -uy[i] * uz[i];
+            }
+        }
+        else
+        {
+            memset(sxx, 0, spatialCount * sizeof(PRECISION));
+            memset(syy, 0, spatialCount * sizeof(PRECISION));
+            memset(szz, 0, spatialCount * sizeof(PRECISION));
+            memset(sxy, 0, spatialCount * sizeof(PRECISION));
+            memset(sxz, 0, spatialCount * sizeof(PRECISION));
+            memset(syz, 0, spatialCount * sizeof(PRECISION));
         }
-        plusEq(rhs->z->spectral, B2->spectral);
-    }
-
-    if(buoyancy)
-    {
-        complex PRECISION * zfield = rhs->z->spectral;
-        complex PRECISION * tfield = T->spectral;
 
-        PRECISION factor =  Ra * Pr;
-        index = 0;
-        for(i = 0; i < spectralCount; i++)
+        if(lorentz)
         {
-            zfield[i] += factor * tfield[i];
+            PRECISION * bx = B->vec->x->spatial;
+            PRECISION * by = B->vec->y->spatial;
+            PRECISION * bz = B->vec->z->spatial;
+            for(i = 0; i < spatialCount; i++)
+            {
+                sxx[i] += alpha * bx[i] * bx[i];
+                syy[i] += alpha * by[i] * by[i];
+                szz[i] += alpha * bz[i] * bz[i];
+                sxy[i] += alpha * bx[i] * by[i];
+                sxz[i] += alpha * bx[i] * bz[i];
+                syz[i] += alpha * by[i] * bz[i];
+            }
         }
+        fftForwardBatch(tense, 6);
+
+        for(i = 0; i < 6; i++)
+            m.stress[i] = tense[i]->spectral;
     }
-    
-    //curl it so we can avoid dealing with the pressure term
-    curl(rhs, temp1);
 
-    //The third parameter as a 1 means we store the result in the force
-    //arrays for u->sol.
-    decomposeCurlSolenoidal(u->sol, temp1, 1);
+    if(!add || m.stress[0] || m.body[0])
+    {
+        momentumKernel(&m, add);
+    }
     debug("Momentum forces done\n");
 }
 
@@ -518,7 +831,7 @@ void calcMag()
     int index;
     debug("Calculating Magnetic forces\n");
 
-    if(magDiff)
+    if(magDiff && diffusionMethod == DIFFUSE_EXPLICIT)
     {
         laplacian(B->vec->x->spectral, rhs->x->spectral, 0, Pr/Pm);
         laplacian(B->vec->y->spectral, rhs->y->spectral, 0, Pr/Pm);
@@ -572,9 +885,8 @@ void calcMag()
         p_vector cuxb = temp2;
 
         crossProduct(u->vec, B->vec, uxb);
-        fftForward(uxb->x);
-        fftForward(uxb->y);
-        fftForward(uxb->z);
+        p_field uxbField[3] = {uxb->x, uxb->y, uxb->z};
+        fftForwardBatch(uxbField, 3);
 
         curl(uxb, cuxb);
 
@@ -608,7 +920,7 @@ void calcTemp()
 {
     complex PRECISION * forces = T->force1;
     
-    if(tDiff)
+    if(tDiff && diffusionMethod == DIFFUSE_EXPLICIT)
     {
         laplacian(T->spectral, forces, 0, 1.0);
     }
@@ -631,9 +943,8 @@ void calcTemp()
         multiply(u->vec->y->spatial, T->spatial, flux->y->spatial);
         multiply(u->vec->z->spatial, T->spatial, flux->z->spatial);
 
-        fftForward(flux->x);
-        fftForward(flux->y);
-        fftForward(flux->z);
+        p_field fluxField[3] = {flux->x, flux->y, flux->z};
+        fftForwardBatch(fluxField, 3);
 
         p_field advect = temp2->x;
         divergence(flux, advect);
@@ -673,15 +984,18 @@ void finalizePhysics()
  * This is an entry point to the time integration.  When things are fully
  * running we do a third level Adams-Bashforth scheme which requires knowing the
  * past three forcing evaluations.  Since these are not available intitially,
- * the first few steps are lower order while we ramp up.
+ * the first few steps are lower order while we ramp up.  The same goes for a
+ * restart from a Runge-Kutta checkpoint, which carries no past forces, so we
+ * count from historyStart rather than from the beginning of the run.
  */
 void step()
 {
-    if(iteration == 1)
+    int steps = iteration - historyStart;
+    if(steps == 1)
     {
         eulerStep();
     }
-    else if(iteration == 2)
+    else if(steps == 2)
     {
         AB2Step();
     }
@@ -695,296 +1009,309 @@ void step()
 /*
  * Horribly basic explicit euler step.  We just add dt * force to all of our 
  * variables.
+ */
+void eulerStep()
+{
+    PRECISION c[3] = {dt, 0, 0};
+
+    multistep(1, c);
+}
+
+/*
+ * See AB3Step for more comments.
+ */
+void AB2Step()
+{
+    PRECISION c[3];
+
+    c[0] = dt * (0.5 * dt / dt1 + 1);
+    c[1] = -0.5 * dt * dt / dt1;
+    c[2] = 0;
+
+    multistep(2, c);
+}
+
+/*
+ * This is our main integration routine.  AB methods rely on knowing the past
+ * state of the system for multiple times in the past.  In essence, this method
+ * interpolates a curve between these last known points, and then performs an
+ * exact integration over this curve to proceed from the last time step to the
+ * next.  The fact that we have variable time steps complicates the derived 
+ * coefficients, as can be seen by c[0], c[1] and c[2].
+ */
+void AB3Step()
+{
+    PRECISION c[3];
+
+    c[0] =  dt + (dt/dt1)*(dt/(dt1+dt2))*(dt/3.0 + 0.5*(2*dt1+ dt2));
+    c[1] = -(dt/dt1)*(dt/(dt2))*(dt/3.0 + 0.5*(dt1+dt2));
+    c[2] = (dt/(dt1 + dt2))*(dt/(dt2))*(dt/3.0 + 0.5*dt1);
+
+    multistep(3, c);
+}
+
+/*
+ * Applies an Adams-Bashforth step of the given order, with coefficients c, to
+ * every state variable.
  * 
  * For divergence free variables, we do time integration on the poloidal and
  * toroidal scalars, rather than on the vector itself.  This makes things
  * slightly verbose, as we then have to manually track the horizontal means
- * as well.
+ * as well.  The diffusion of every one of these is still just nu del^2 of
+ * itself, which is what lets abArray treat it separately.
  */
-void eulerStep()
+void multistep(int order, PRECISION * c)
 {
-    int i;
-    
-    complex PRECISION * func;
-    complex PRECISION * f1;
-
     if(momEquation)
     {
-        func = u->sol->poloidal->spectral;
-        f1 = u->sol->poloidal->force1;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += dt * f1[i];
-        }
-
-        func = u->sol->toroidal->spectral;
-        f1 = u->sol->toroidal->force1;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += dt * f1[i];
-        }
-
-        func = u->sol->mean_x;
-        f1 = u->sol->mean_xf1;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += dt * f1[i];
-        }
-
-        func = u->sol->mean_y;
-        f1 = u->sol->mean_yf1;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += dt * f1[i];
-        }
+        PRECISION nu = viscosity ? Pr : 0;
+        p_solenoid s = u->sol;
+        abArray(s->poloidal->spectral, s->poloidal->force1, s->poloidal->force2, s->poloidal->force3, order, c, nu, 0);
+        abArray(s->toroidal->spectral, s->toroidal->force1, s->toroidal->force2, s->toroidal->force3, order, c, nu, 0);
+        abArray(s->mean_x, s->mean_xf1, s->mean_xf2, s->mean_xf3, order, c, nu, 1);
+        abArray(s->mean_y, s->mean_yf1, s->mean_yf2, s->mean_yf3, order, c, nu, 1);
     }
 
     if(magEquation)
     {
-        func = B->sol->poloidal->spectral;
-        f1 = B->sol->poloidal->force1;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += dt * f1[i];
-        }
-
-        func = B->sol->toroidal->spectral;
-        f1 = B->sol->toroidal->force1;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += dt * f1[i];
-        }
-
-        func = B->sol->mean_x;
-        f1 = B->sol->mean_xf1;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += dt * f1[i];
-        }
-
-        func = B->sol->mean_y;
-        f1 = B->sol->mean_yf1;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += dt * f1[i];
-        }
+        PRECISION nu = magDiff ? Pr / Pm : 0;
+        p_solenoid s = B->sol;
+        abArray(s->poloidal->spectral, s->poloidal->force1, s->poloidal->force2, s->poloidal->force3, order, c, nu, 0);
+        abArray(s->toroidal->spectral, s->toroidal->force1, s->toroidal->force2, s->toroidal->force3, order, c, nu, 0);
+        abArray(s->mean_x, s->mean_xf1, s->mean_xf2, s->mean_xf3, order, c, nu, 1);
+        abArray(s->mean_y, s->mean_yf1, s->mean_yf2, s->mean_yf3, order, c, nu, 1);
     }
 
     if(tEquation)
     {
-        func = T->spectral;
-        f1 = T->force1;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += dt * f1[i];
-        }
+        abArray(T->spectral, T->force1, T->force2, T->force3, order, c, tDiff ? 1.0 : 0, 0);
     }
 }
 
 /*
- * See AB3Step for more comments.
+ * Advances one array, with the forces from the last order evaluations in f1,
+ * f2 and f3.  mean says the array is a horizontal mean, indexed by kz alone,
+ * rather than a full spectral array.
+ * 
+ * With explicit diffusion everything is in the forces, and this is a plain
+ * AB step.  Otherwise the forces leave out the diffusion, nu del^2, which for
+ * each mode is just decay at the rate a = nu k^2, and it is handled here.
+ * 
+ * DIFFUSE_EXACT:      Integrating factor.  We do the AB step on e^(a t) times
+ *                     the mode, which has no diffusion term at all, so each
+ *                     past force is decayed by the time since it was found.
+ * DIFFUSE_IMPLICIT:   Crank-Nicolson for the diffusion, averaging it between
+ *                     the old and new values, with AB for the rest.
+ * 
+ * Either way the diffusion is stable for any dt, and calcNewTimestep only
+ * needs to worry about advection.  Every mode is updated independently, so
+ * the long loops are split among threads.
  */
-void AB2Step()
+void abArray(complex PRECISION * func, complex PRECISION * f1, complex PRECISION * f2, complex PRECISION * f3, int order, PRECISION * c, PRECISION nu, int mean)
 {
-    int i;
-
-    complex PRECISION * func;
-    complex PRECISION * f1;
-    complex PRECISION * f2;
-
-    PRECISION c0 = dt * (0.5 * dt / dt1 + 1);
-    PRECISION c1 = -0.5 * dt * dt / dt1;
+    int i,j,k;
+    int count = mean ? ndkz : spectralCount;
 
-    if(momEquation)
+    if(nu == 0 || diffusionMethod == DIFFUSE_EXPLICIT)
     {
-        func = u->sol->poloidal->spectral;
-        f1 = u->sol->poloidal->force1;
-        f2 = u->sol->poloidal->force2;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i];
-        }
-
-        func = u->sol->toroidal->spectral;
-        f1 = u->sol->toroidal->force1;
-        f2 = u->sol->toroidal->force2;
-        for(i = 0; i < spectralCount; i++)
+        if(order == 1)
         {
-            func[i] += c0 * f1[i] + c1 * f2[i];
+            #pragma omp parallel for if(!mean)
+            for(i = 0; i < count; i++)
+            {
+                func[i] += c[0] * f1[i];
+            }
         }
-
-        func = u->sol->mean_x;
-        f1 = u->sol->mean_xf1;
-        f2 = u->sol->mean_xf2;
-        for(i = 0; i < ndkz; i++)
+        else if(order == 2)
         {
-            func[i] += c0 * f1[i] + c1 * f2[i];
+            #pragma omp parallel for if(!mean)
+            for(i = 0; i < count; i++)
+            {
+                func[i] += c[0] * f1[i] + c[1] * f2[i];
+            }
         }
-
-        func = u->sol->mean_y;
-        f1 = u->sol->mean_yf1;
-        f2 = u->sol->mean_yf2;
-        for(i = 0; i < ndkz; i++)
+        else
         {
-            func[i] += c0 * f1[i] + c1 * f2[i];
+            #pragma omp parallel for if(!mean)
+            for(i = 0; i < count; i++)
+            {
+                func[i] += c[0] * f1[i] + c[1] * f2[i] + c[2] * f3[i];
+            }
         }
+        return;
     }
 
-    if(magEquation)
-    {
-        func = B->sol->poloidal->spectral;
-        f1 = B->sol->poloidal->force1;
-        f2 = B->sol->poloidal->force2;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i];
-        }
-
-        func = B->sol->toroidal->spectral;
-        f1 = B->sol->toroidal->force1;
-        f2 = B->sol->toroidal->force2;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i];
-        }
-
-        func = B->sol->mean_x;
-        f1 = B->sol->mean_xf1;
-        f2 = B->sol->mean_xf2;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i];
-        }
-
-        func = B->sol->mean_y;
-        f1 = B->sol->mean_yf1;
-        f2 = B->sol->mean_yf2;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i];
-        }
-    }
+    //the means are the kx = ky = 0 column
+    int nkx = mean ? 1 : my_kx->width;
+    int nky = mean ? 1 : my_ky->width;
 
-    if(tEquation)
+    #pragma omp parallel for private(j,k) if(!mean)
+    for(i = 0; i < nkx; i++)
     {
-        func = T->spectral;
-        f1 = T->force1;
-        f2 = T->force2;
-        for(i = 0; i < spectralCount; i++)
+        PRECISION kx = mean ? 0 : kxTable[i];
+        for(j = 0; j < nky; j++)
         {
-            func[i] += c0 * f1[i] + c1 * f2[i];
+            PRECISION ky = mean ? 0 : kyTable[j];
+            int index = (i * nky + j) * ndkz;
+            for(k = 0; k < ndkz; k++)
+            {
+                PRECISION kz = kzTable[k];
+                PRECISION a = nu * (kx * kx + ky * ky + kz * kz);
+
+                if(diffusionMethod == DIFFUSE_EXACT)
+                {
+                    PRECISION e = exp(-a * dt);
+                    complex PRECISION next = e * (func[index] + c[0] * f1[index]);
+                    if(order > 1)
+                    {
+                        e *= exp(-a * dt1);
+                        next += e * c[1] * f2[index];
+                    }
+                    if(order > 2)
+                    {
+                        e *= exp(-a * dt2);
+                        next += e * c[2] * f3[index];
+                    }
+                    func[index] = next;
+                }
+                else
+                {
+                    PRECISION h = 0.5 * dt * a;
+                    complex PRECISION sum = c[0] * f1[index];
+                    if(order > 1)
+                        sum += c[1] * f2[index];
+                    if(order > 2)
+                        sum += c[2] * f3[index];
+                    func[index] = ((1 - h) * func[index] + sum) / (1 + h);
+                }
+                index++;
+            }
         }
     }
 }
 
 /*
- * This is our main integration routine.  AB methods rely on knowing the past
- * state of the system for multiple times in the past.  In essence, this method
- * interpolates a curve between these last known points, and then performs an
- * exact integration over this curve to proceed from the last time step to the
- * next.  The fact that we have variable time steps complicates the derived 
- * coefficients, as can be seen by c0, c1 and c2.
+ * Takes a full step with one of the low storage Runge-Kutta schemes.  Unlike
+ * AB3 these need no past forces, so there is no ramp up and a restart picks
+ * up at full order.  Each field needs only the state plus the register q,
+ * kept in force2, on top of the force evaluation itself in force1.
+ * 
+ * Every stage needs a fresh force evaluation at its own time, so the spatial
+ * state is brought up to date between stages, and elapsedTime is moved along
+ * for the time dependent forcings.
  */
-void AB3Step()
+void rkStep()
 {
-    int i;
-
-    complex PRECISION * func;
-    complex PRECISION * f1;
-    complex PRECISION * f2;
-    complex PRECISION * f3;
-
-    PRECISION c0 =  dt + (dt/dt1)*(dt/(dt1+dt2))*(dt/3.0 + 0.5*(2*dt1+ dt2));
-    PRECISION c1 = -(dt/dt1)*(dt/(dt2))*(dt/3.0 + 0.5*(dt1+dt2));
-    PRECISION c2 = (dt/(dt1 + dt2))*(dt/(dt2))*(dt/3.0 + 0.5*dt1);
+    const PRECISION * A = rk3A;
+    const PRECISION * B = rk3B;
+    const PRECISION * C = rk3C;
+    int stages = 3;
+    if(integrator == INTEGRATE_RK4)
+    {
+        A = rk4A;
+        B = rk4B;
+        C = rk4C;
+        stages = 5;
+    }
 
-    if(momEquation)
+    PRECISION start = elapsedTime;
+    int s;
+    for(s = 0; s < stages; s++)
     {
-        func = u->sol->poloidal->spectral;
-        f1 = u->sol->poloidal->force1;
-        f2 = u->sol->poloidal->force2;
-        f3 = u->sol->poloidal->force3;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
-        }
+        if(s > 0)
+            updateState();
 
-        func = u->sol->toroidal->spectral;
-        f1 = u->sol->toroidal->force1;
-        f2 = u->sol->toroidal->force2;
-        f3 = u->sol->toroidal->force3;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
-        }
+        elapsedTime = start + C[s] * dt;
+        calcForces();
 
-        func = u->sol->mean_x;
-        f1 = u->sol->mean_xf1;
-        f2 = u->sol->mean_xf2;
-        f3 = u->sol->mean_xf3;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
-        }
+        PRECISION next = s + 1 < stages ? C[s+1] : 1.0;
+        prof_start(PROF_INTEGRATE);
+        rkStage(A[s], B[s], next - C[s]);
+        prof_stop(PROF_INTEGRATE);
+    }
+    elapsedTime = start + dt;
+}
 
-        func = u->sol->mean_y;
-        f1 = u->sol->mean_yf1;
-        f2 = u->sol->mean_yf2;
-        f3 = u->sol->mean_yf3;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
-        }
+/*
+ * Applies one Runge-Kutta stage to every state variable.  frac is the
+ * fraction of dt from this stage to the next one, which the integrating
+ * factor needs.
+ */
+void rkStage(PRECISION a, PRECISION b, PRECISION frac)
+{
+    if(momEquation)
+    {
+        PRECISION nu = viscosity ? Pr : 0;
+        p_solenoid s = u->sol;
+        rkArray(s->poloidal->spectral, s->poloidal->force1, s->poloidal->force2, a, b, frac, nu, 0);
+        rkArray(s->toroidal->spectral, s->toroidal->force1, s->toroidal->force2, a, b, frac, nu, 0);
+        rkArray(s->mean_x, s->mean_xf1, s->mean_xf2, a, b, frac, nu, 1);
+        rkArray(s->mean_y, s->mean_yf1, s->mean_yf2, a, b, frac, nu, 1);
     }
 
     if(magEquation)
     {
-        func = B->sol->poloidal->spectral;
-        f1 = B->sol->poloidal->force1;
-        f2 = B->sol->poloidal->force2;
-        f3 = B->sol->poloidal->force3;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
-        }
+        PRECISION nu = magDiff ? Pr / Pm : 0;
+        p_solenoid s = B->sol;
+        rkArray(s->poloidal->spectral, s->poloidal->force1, s->poloidal->force2, a, b, frac, nu, 0);
+        rkArray(s->toroidal->spectral, s->toroidal->force1, s->toroidal->force2, a, b, frac, nu, 0);
+        rkArray(s->mean_x, s->mean_xf1, s->mean_xf2, a, b, frac, nu, 1);
+        rkArray(s->mean_y, s->mean_yf1, s->mean_yf2, a, b, frac, nu, 1);
+    }
 
-        func = B->sol->toroidal->spectral;
-        f1 = B->sol->toroidal->force1;
-        f2 = B->sol->toroidal->force2;
-        f3 = B->sol->toroidal->force3;
-        for(i = 0; i < spectralCount; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
-        }
+    if(tEquation)
+    {
+        rkArray(T->spectral, T->force1, T->force2, a, b, frac, tDiff ? 1.0 : 0, 0);
+    }
+}
 
-        func = B->sol->mean_x;
-        f1 = B->sol->mean_xf1;
-        f2 = B->sol->mean_xf2;
-        f3 = B->sol->mean_xf3;
-        for(i = 0; i < ndkz; i++)
-        {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
-        }
+/*
+ * One stage of the 2N scheme for one array, with the new force in F and the
+ * register in q.  The first stage has a = 0, and must not touch q, which is
+ * left over from the last step (or never set at all).
+ * 
+ * With DIFFUSE_EXACT the scheme is run on e^(a t) times each mode, just as in
+ * abArray.  Keeping q and the mode scaled to the time of the next stage means
+ * both simply decay by e^(-nu k^2 frac dt) each stage.
+ */
+void rkArray(complex PRECISION * func, complex PRECISION * F, complex PRECISION * q, PRECISION a, PRECISION b, PRECISION frac, PRECISION nu, int mean)
+{
+    int i,j,k;
+    int count = mean ? ndkz : spectralCount;
 
-        func = B->sol->mean_y;
-        f1 = B->sol->mean_yf1;
-        f2 = B->sol->mean_yf2;
-        f3 = B->sol->mean_yf3;
-        for(i = 0; i < ndkz; i++)
+    if(nu == 0 || diffusionMethod == DIFFUSE_EXPLICIT)
+    {
+        #pragma omp parallel for if(!mean)
+        for(i = 0; i < count; i++)
         {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
+            q[i] = a == 0 ? dt * F[i] : a * q[i] + dt * F[i];
+            func[i] += b * q[i];
         }
+        return;
     }
 
-    if(tEquation)
+    //the means are the kx = ky = 0 column
+    int nkx = mean ? 1 : my_kx->width;
+    int nky = mean ? 1 : my_ky->width;
+
+    #pragma omp parallel for private(j,k) if(!mean)
+    for(i = 0; i < nkx; i++)
     {
-        func = T->spectral;
-        f1 = T->force1;
-        f2 = T->force2;
-        f3 = T->force3;
-        for(i = 0; i < spectralCount; i++)
+        PRECISION kx = mean ? 0 : kxTable[i];
+        for(j = 0; j < nky; j++)
         {
-            func[i] += c0 * f1[i] + c1 * f2[i] + c2 * f3[i];
+            PRECISION ky = mean ? 0 : kyTable[j];
+            int index = (i * nky + j) * ndkz;
+            for(k = 0; k < ndkz; k++)
+            {
+                PRECISION kz = kzTable[k];
+                PRECISION e = exp(-nu * (kx * kx + ky * ky + kz * kz) * frac * dt);
+                complex PRECISION prev = a == 0 ? 0 : a * q[index];
+
+                q[index] = e * (prev + dt * F[index]);
+                func[index] = e * func[index] + b * q[index];
+                index++;
+            }
         }
     }
 }
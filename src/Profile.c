@@ -0,0 +1,133 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Profile.h"
+#include "Environment.h"
+#include "Log.h"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+
+const char * profNames[PROF_REGIONS] = {"step", "timestep", "momentum",
+    "temp", "mag", "integrate", "output", "checkpoint", "transform", "fft",
+    "pack", "alltoall", "unpack"};
+
+double profTime[PROF_REGIONS];
+double profBegin[PROF_REGIONS];
+long profCalls[PROF_REGIONS];
+
+double profCost = 0;    //what one prof_start/prof_stop pair costs
+double profWall = 0;    //wall clock at the last report
+int profLast = 0;       //iteration at the last report
+
+void prof_zero()
+{
+    memset(profTime, 0, PROF_REGIONS * sizeof(double));
+    memset(profCalls, 0, PROF_REGIONS * sizeof(long));
+    profWall = MPI_Wtime();
+    profLast = iteration;
+}
+
+void prof_init()
+{
+    int i;
+    int reps = 1000;
+    FILE * out;
+
+    //Time a batch of empty regions so the reports can say how much of the run
+    //the profiler itself is responsible for
+    double start = MPI_Wtime();
+    for(i = 0; i < reps; i++)
+    {
+        prof_start(PROF_STEP);
+        prof_stop(PROF_STEP);
+    }
+    profCost = (MPI_Wtime() - start) / reps;
+
+    prof_zero();
+
+    if(crank == 0)
+    {
+        out = fopen("profile", startFlag == CHECKPOINT ? "a" : "w");
+        fprintf(out, "Seconds per step spent in each region, over the compute nodes\n");
+        fclose(out);
+    }
+}
+
+void prof_start(int region)
+{
+    profBegin[region] = MPI_Wtime();
+}
+
+void prof_stop(int region)
+{
+    profTime[region] += MPI_Wtime() - profBegin[region];
+    profCalls[region]++;
+}
+
+void prof_report()
+{
+    int i;
+    long total = 0;
+    double local[PROF_REGIONS + 1];
+    double tmin[PROF_REGIONS + 1];
+    double tmax[PROF_REGIONS + 1];
+    double tsum[PROF_REGIONS + 1];
+    long calls[PROF_REGIONS];
+    FILE * out;
+
+    int steps = iteration - profLast;
+    double wall = MPI_Wtime() - profWall;
+    if(steps <= 0)
+        return;
+
+    //the last entry is the fraction of the interval spent in the profiler
+    for(i = 0; i < PROF_REGIONS; i++)
+    {
+        local[i] = profTime[i] / steps;
+        total += profCalls[i];
+    }
+    local[PROF_REGIONS] = (wall > 0 ? total * profCost / wall : 0);
+
+    MPI_Reduce(local, tmin, PROF_REGIONS + 1, MPI_DOUBLE, MPI_MIN, 0, ccomm);
+    MPI_Reduce(local, tmax, PROF_REGIONS + 1, MPI_DOUBLE, MPI_MAX, 0, ccomm);
+    MPI_Reduce(local, tsum, PROF_REGIONS + 1, MPI_DOUBLE, MPI_SUM, 0, ccomm);
+    MPI_Reduce(profCalls, calls, PROF_REGIONS, MPI_LONG, MPI_MAX, 0, ccomm);
+
+    if(crank == 0)
+    {
+        out = fopen("profile", "a");
+        fprintf(out, "\nIteration %d: %d steps in %g s, profiler overhead %.3f%%\n", iteration, steps, wall, 100 * tmax[PROF_REGIONS]);
+        fprintf(out, "%-12s %10s %12s %12s %12s %10s\n", "region", "calls", "min", "mean", "max", "imbalance");
+        for(i = 0; i < PROF_REGIONS; i++)
+        {
+            //skip regions this run never enters, i.e. an equation that is off
+            if(calls[i] == 0)
+                continue;
+
+            double mean = tsum[i] / csize;
+            fprintf(out, "%-12s %10ld %12.5e %12.5e %12.5e %10.3f\n", profNames[i], calls[i], tmin[i], mean, tmax[i], (mean > 0 ? tmax[i] / mean : 1));
+        }
+        fclose(out);
+    }
+
+    prof_zero();
+}
+
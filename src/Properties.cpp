@@ -36,6 +36,7 @@ using namespace std;
 #define PHYSICS "Physics"
 #define FORCINGS "Forcings"
 #define INTEGRATION "Integration"
+#define BENCHMARK "Benchmark"
 
 const string on("on");
 const string off("off");
@@ -52,6 +53,7 @@ void parseIC(iostream & in);
 void parsePhysics(iostream & in);
 void parseForcings(iostream & in);
 void parseIntegration(iostream & in);
+void parseBenchmark(iostream & in);
 
 //Currently does nothing...
 void init();
@@ -111,6 +113,10 @@ void loadPrefs(char * loc)
         {
             parseIntegration(input);
         }
+        else if(section == BENCHMARK)
+        {
+            parseBenchmark(input);
+        }
     }
 }
 
@@ -133,6 +139,13 @@ void parseProblemSize(iostream & in)
     const string szmx("zmx");
     const string shdiv("hdiv");
     const string svdiv("vdiv");
+    const string sthreads("threads");
+    const string swisdom("wisdom");
+    const string spatient("patient");
+    const string sfloatTranspose("floatTranspose");
+    const string sautoTrial("autoTrial");
+    const string snodePlacement("nodePlacement");
+    const string sauto("auto");
 
     string line;
     string one;
@@ -191,13 +204,90 @@ void parseProblemSize(iostream & in)
         }
         else if((int)one.find(shdiv) != -1)
         {
-            hdiv = atoi(two.c_str());
-            debug("hdiv = %d\n", hdiv);
+            //auto for either one lets the code pick both
+            if((int)two.find(sauto) != -1)
+                autoDecomp = 1;
+            else
+                hdiv = atoi(two.c_str());
+            debug("hdiv = %d, auto = %d\n", hdiv, autoDecomp);
         }
         else if((int)one.find(svdiv) != -1)
         {
-            vdiv = atoi(two.c_str());
-            debug("vdiv = %d\n", vdiv);
+            if((int)two.find(sauto) != -1)
+                autoDecomp = 1;
+            else
+                vdiv = atoi(two.c_str());
+            debug("vdiv = %d, auto = %d\n", vdiv, autoDecomp);
+        }
+        else if((int)one.find(sautoTrial) != -1)
+        {
+            if((int)two.find(on) != -1)
+                autoTrial = 1;
+            else if((int)two.find(off) != -1)
+                autoTrial = 0;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("Measured layout trial flag: %d\n", autoTrial);
+        }
+        else if((int)one.find(snodePlacement) != -1)
+        {
+            if((int)two.find(on) != -1)
+                nodePlacement = 1;
+            else if((int)two.find(off) != -1)
+                nodePlacement = 0;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("Node aware placement flag: %d\n", nodePlacement);
+        }
+        else if((int)one.find(sthreads) != -1)
+        {
+            nthreads = atoi(two.c_str());
+            debug("threads = %d\n", nthreads);
+        }
+        else if((int)one.find(swisdom) != -1)
+        {
+            if((int)two.find(on) != -1)
+                fftWisdom = 1;
+            else if((int)two.find(off) != -1)
+                fftWisdom = 0;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("FFTW wisdom flag: %d\n", fftWisdom);
+        }
+        else if((int)one.find(spatient) != -1)
+        {
+            if((int)two.find(on) != -1)
+                fftPatient = 1;
+            else if((int)two.find(off) != -1)
+                fftPatient = 0;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("FFTW patient planning flag: %d\n", fftPatient);
+        }
+        else if((int)one.find(sfloatTranspose) != -1)
+        {
+            if((int)two.find(on) != -1)
+                floatTranspose = 1;
+            else if((int)two.find(off) != -1)
+                floatTranspose = 0;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("Single precision transpose flag: %d\n", floatTranspose);
         }
         else
         {
@@ -215,6 +305,14 @@ void parseIO(iostream & in)
     const string scalarr("scalarRate");
     const string scalarpf("scalarPerF");
     const string sCheckRate("checkRate");
+    const string scompression("compression");
+    const string suTol("uTol");
+    const string svTol("vTol");
+    const string swTol("wTol");
+    const string sTTol("TTol");
+    const string sBxTol("BxTol");
+    const string sByTol("ByTol");
+    const string sBzTol("BzTol");
 
     string line;
     string one;
@@ -264,6 +362,57 @@ void parseIO(iostream & in)
             checkRate = atoi(two.c_str());
             debug("checkpoint frequency = %d\n", checkRate);
         }
+        else if((int)one.find(scompression) != -1)
+        {
+            transform(two.begin(), two.end(), two.begin(), ::tolower);
+            if((int)two.find("lossless") != -1)
+                spatialCompression = COMPRESS_LOSSLESS;
+            else if((int)two.find("lossy") != -1)
+                spatialCompression = COMPRESS_LOSSY;
+            else if((int)two.find(off) != -1)
+                spatialCompression = COMPRESS_OFF;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("spatial compression = %d\n", spatialCompression);
+        }
+        else if((int)one.find(suTol) != -1)
+        {
+            uTol = atof(two.c_str());
+            debug("u tolerance = %g\n", uTol);
+        }
+        else if((int)one.find(svTol) != -1)
+        {
+            vTol = atof(two.c_str());
+            debug("v tolerance = %g\n", vTol);
+        }
+        else if((int)one.find(swTol) != -1)
+        {
+            wTol = atof(two.c_str());
+            debug("w tolerance = %g\n", wTol);
+        }
+        else if((int)one.find(sTTol) != -1)
+        {
+            TTol = atof(two.c_str());
+            debug("T tolerance = %g\n", TTol);
+        }
+        else if((int)one.find(sBxTol) != -1)
+        {
+            BxTol = atof(two.c_str());
+            debug("Bx tolerance = %g\n", BxTol);
+        }
+        else if((int)one.find(sByTol) != -1)
+        {
+            ByTol = atof(two.c_str());
+            debug("By tolerance = %g\n", ByTol);
+        }
+        else if((int)one.find(sBzTol) != -1)
+        {
+            BzTol = atof(two.c_str());
+            debug("Bz tolerance = %g\n", BzTol);
+        }
         else
         {
             warn("Found unknown value!!:  %s\n", line.c_str());
@@ -351,6 +500,7 @@ void parsePhysics(iostream & in)
     const string sPM("Pm");
     const string sAlpha("alpha");
     const string sMBuoyScale("mBuoyScale");
+    const string sNonlinear("nonlinearForm");
     
     string line;
     string one;
@@ -555,6 +705,19 @@ void parsePhysics(iostream & in)
             magBuoyScale = atof(two.c_str());
             debug("mBuoyScale set to %g\n", alpha);
         }
+        else if((int)one.find(sNonlinear) != -1)
+        {
+            transform(two.begin(), two.end(), two.begin(), ::tolower);
+            if((int)two.find("divergence") != -1)
+                nonlinearForm = NONLINEAR_DIVERGENCE;
+            else if((int)two.find("rotational") != -1)
+                nonlinearForm = NONLINEAR_ROTATIONAL;
+            else
+            {
+                warn("unrecognized option %s for %s\n", two.c_str(), one.c_str());
+            }
+            debug("nonlinear form: %d\n", nonlinearForm);
+        }
         else
         {
             warn("Found unknown value!!:  %s %s\n", one.c_str(), two.c_str());
@@ -752,6 +915,8 @@ void parseIntegration(iostream & in)
     const string sSafety("safetyFactor");
     const string sMaxSteps("maxSteps");
     const string sMaxTime("maxTime");
+    const string sDiffusion("diffusion");
+    const string sIntegrator("integrator");
 
     string line;
     string one;
@@ -786,6 +951,38 @@ void parseIntegration(iostream & in)
             maxTime = atof(two.c_str());
             debug("maxTime = %f\n", maxTime);
         }
+        else if((int)one.find(sDiffusion) != -1)
+        {
+            transform(two.begin(), two.end(), two.begin(), ::tolower);
+            if((int)two.find("explicit") != -1)
+                diffusionMethod = DIFFUSE_EXPLICIT;
+            else if((int)two.find("exact") != -1)
+                diffusionMethod = DIFFUSE_EXACT;
+            else if((int)two.find("implicit") != -1)
+                diffusionMethod = DIFFUSE_IMPLICIT;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("diffusion method = %d\n", diffusionMethod);
+        }
+        else if((int)one.find(sIntegrator) != -1)
+        {
+            transform(two.begin(), two.end(), two.begin(), ::tolower);
+            if((int)two.find("ab3") != -1)
+                integrator = INTEGRATE_AB3;
+            else if((int)two.find("rk3") != -1)
+                integrator = INTEGRATE_RK3;
+            else if((int)two.find("rk4") != -1)
+                integrator = INTEGRATE_RK4;
+            else
+            {
+                warn("unrecognized option %s for %s", two.c_str(), one.c_str());
+            }
+
+            debug("integrator = %d\n", integrator);
+        }
         else
         {
             warn("Found unknown value!!:  %s\n", line.c_str());
@@ -793,4 +990,87 @@ void parseIntegration(iostream & in)
     }
 }
 
+/*
+ * Only used when the code is started in benchmark mode.  The list valued
+ * entries are stored as strings and parsed by the benchmark itself.
+ */
+void parseBenchmark(iostream & in)
+{
+    const string sDecomps("decompositions");
+    const string sGrids("grids");
+    const string sPhysics("physics");
+    const string sFFTs("ffts");
+    const string sSteps("steps");
+    const string sWarmup("warmup");
+    const string sRepeats("repeats");
+    const string sOutput("output");
+
+    string line;
+    string one;
+    string two;
+    int index;
 
+    debug("Loading Benchmark Parameters\n",0)
+    while(!getline(in, line).eof())
+    {
+        trace("Reading line %s\n", line.c_str());
+        index = line.find_first_of('=');
+        if((int)line.find_first_of("[") != -1)
+            return;
+        if(index == -1)
+            continue;
+
+        one = line.substr(0, index);
+        two = line.substr(index+1, line.size()-1);
+
+        if((int)one.find(sDecomps) != -1)
+        {
+            benchDecomps = (char*)malloc(two.length()+1);
+            strcpy(benchDecomps, two.c_str());
+            debug("Benchmark decompositions: %s\n", benchDecomps);
+        }
+        else if((int)one.find(sGrids) != -1)
+        {
+            benchGrids = (char*)malloc(two.length()+1);
+            strcpy(benchGrids, two.c_str());
+            debug("Benchmark grids: %s\n", benchGrids);
+        }
+        else if((int)one.find(sPhysics) != -1)
+        {
+            benchPhysics = (char*)malloc(two.length()+1);
+            strcpy(benchPhysics, two.c_str());
+            debug("Benchmark physics sets: %s\n", benchPhysics);
+        }
+        else if((int)one.find(sFFTs) != -1)
+        {
+            benchFFTs = (char*)malloc(two.length()+1);
+            strcpy(benchFFTs, two.c_str());
+            debug("Benchmark ffts: %s\n", benchFFTs);
+        }
+        else if((int)one.find(sSteps) != -1)
+        {
+            benchSteps = atoi(two.c_str());
+            debug("Benchmark steps = %d\n", benchSteps);
+        }
+        else if((int)one.find(sWarmup) != -1)
+        {
+            benchWarmup = atoi(two.c_str());
+            debug("Benchmark warmup steps = %d\n", benchWarmup);
+        }
+        else if((int)one.find(sRepeats) != -1)
+        {
+            benchRepeats = atoi(two.c_str());
+            debug("Benchmark transform repeats = %d\n", benchRepeats);
+        }
+        else if((int)one.find(sOutput) != -1)
+        {
+            benchOutput = (char*)malloc(two.length()+1);
+            strcpy(benchOutput, two.c_str());
+            debug("Benchmark output: %s\n", benchOutput);
+        }
+        else
+        {
+            warn("Found unknown value!!:  %s\n", line.c_str());
+        }
+    }
+}
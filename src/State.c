@@ -32,6 +32,7 @@
 //These are "private" and never called outside this file.
 void startScratch();
 void startSpatial();
+void startField(char * fieldName, int container);
 
 /*
  * Here we allocate memory for our state variables, and initialize them
@@ -295,34 +296,47 @@ void startScratch()
 }
 
 /*
- * User has specified a folder on disk containing dumps of the state variables,
- * and we will read them in and use them as initial conditions.
+ * User has specified a spatial dump of the state variables, and we will read
+ * them in and use them as initial conditions.  startDir may also be a folder
+ * holding a file for each variable and an info file, the way dumps used to be
+ * written.
  */
 void startSpatial()
 {
     char name[100];
+    int container = 0;
+    int dumpIteration;
 
     //If we are continuing from another simulation, but not using checkpoints 
     //for some reason, then we need to recover the simulation time that this
     //data dump was made at.
     if(grank == 0)
     {
-        sprintf(name,"%s/info",startDir);
-        FILE * info;
-        info = fopen(name, "r");
-        if(info)
+        container = spatialDumpInfo(startDir, &dumpIteration, &elapsedTime);
+        if(container)
         {
-            fscanf(info, infostri, &elapsedTime);
-            fclose(info);
+            info("Starting from the dump of iteration %d\n", dumpIteration);
         }
         else
         {
-            elapsedTime = 0;
+            sprintf(name,"%s/info",startDir);
+            FILE * info;
+            info = fopen(name, "r");
+            if(info)
+            {
+                fscanf(info, infostri, &elapsedTime);
+                fclose(info);
+            }
+            else
+            {
+                elapsedTime = 0;
+            }
         }
     }
 
     //share out the simulation time so everyone knows.
     MPI_Bcast(&elapsedTime, 1, MPI_PRECISION, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&container, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
     //Read in state variables for any active equations.  Don't bother for
     //variable that won't be used.  They are read in the spatial coordinates
@@ -369,35 +383,42 @@ void startSpatial()
     {
         if(magEquation)
         {
-            sprintf(name,"%s/Bx",startDir);
-            readSpatial(0, name);
-
-            sprintf(name,"%s/By",startDir);
-            readSpatial(0, name);
-
-            sprintf(name,"%s/Bz",startDir);
-            readSpatial(0, name);
+            startField("Bx", container);
+            startField("By", container);
+            startField("Bz", container);
         }
 
         if(momEquation)
         {
-            sprintf(name,"%s/u",startDir);
-            readSpatial(0, name);
-
-            sprintf(name,"%s/v",startDir);
-            readSpatial(0, name);
-
-            sprintf(name,"%s/w",startDir);
-            readSpatial(0, name);
+            startField("u", container);
+            startField("v", container);
+            startField("w", container);
         }
 
         if(tEquation)
         {
-            sprintf(name,"%s/T",startDir);
-            readSpatial(0, name);
+            startField("T", container);
         }
     }
+}
 
+/*
+ * IO node half of reading in one state variable, either out of the dump in
+ * startDir or from the file of that name inside it.
+ */
+void startField(char * fieldName, int container)
+{
+    char name[100];
+
+    if(container)
+    {
+        readSpatialField(0, startDir, fieldName);
+    }
+    else
+    {
+        sprintf(name,"%s/%s",startDir,fieldName);
+        readSpatial(0, name);
+    }
 }
 
 p_componentVar B;
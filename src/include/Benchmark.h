@@ -0,0 +1,53 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/***************************
+ * Benchmark mode, entered by giving the executable a second argument:
+ * 
+ *   proteus <propFile> benchmark
+ * 
+ * Rather than running the configured problem, the code sweeps over every
+ * combination of the grids, decompositions, FFT routines and physics term sets
+ * listed in the [Benchmark] section of the configuration file.  For each case
+ * it times forward/backward transform pairs on their own and full calls to
+ * iterate(), then writes the results along with strong and weak scaling
+ * efficiencies to <output>.csv and <output>.json, so runs from different
+ * builds or machines can be compared directly.
+ * 
+ * Only the time integration is timed, so no output is done and one IO node is
+ * enough.  Decompositions that need more processors than are available are
+ * skipped.  With no decompositions listed, the one from [ProblemSize] is used,
+ * which may be hdiv=auto.
+ ***************************/
+
+#ifndef _BENCHMARK_H
+#define	_BENCHMARK_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    int benchmark(char * propFile);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _BENCHMARK_H */
+
@@ -39,19 +39,36 @@
 
 #define FFT1 1
 #define FFT2 2
+#define FFT3 3
+#define FFT4 4
+#define FFT5 5
+#define NFFT 5
+
+//The most fields that will be pushed through a batched transform at once
+#define MAX_BATCH 7
 
 /*
  * There should be no calls to an fft routine that is not bracketed by these
  * two calls.
  * 
- * There are two possible FFT routines under the hood.  Passing in a nonzero
+ * There are five possible FFT routines under the hood.  Passing in a nonzero
  * entry for measure will make the program take some time initially to measure
- * which of these two has better performance on this particular machine.  In
- * principle it doesn't seem to matter terribly much.
+ * which of these has the best performance on this particular machine.  The
+ * third one overlaps communication with computation, so it should pull ahead
+ * when the network is the bottleneck, and the fourth lets MPI do the local
+ * transposes through derived datatypes, which wins on MPI libraries with
+ * good datatype engines.  The fifth is the first with shared memory in place
+ * of MPI for row or column groups that fit on one node.
  */
 void com_init(int measure);
 void com_finalize();
 
+/*
+ * Switches an initialized com module over to one particular FFT routine,
+ * FFT1 through FFT5.
+ */
+void com_select(int which);
+
 /*
  * The forward routine converts spatial data to spectral data, and the backwards
  * routine does the opposite.  The p_field argument contains pointers to both
@@ -61,6 +78,15 @@ void com_finalize();
 void fftForward(p_field);
 void fftBackward(p_field);
 
+/*
+ * Batched versions of the above, which transform all n fields together.  Each
+ * transpose then costs one all-to-all for the whole batch rather than one per
+ * field, which matters once message latency starts to dominate.  Any n is
+ * accepted, though at most MAX_BATCH fields are in flight at a time.
+ */
+void fftForwardBatch(p_field * fields, int n);
+void fftBackwardBatch(p_field * fields, int n);
+
 
 #endif	/* _COMMUNICATION_H */
 
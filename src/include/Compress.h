@@ -0,0 +1,65 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/***************************
+ * Compression of a plane of a spatial dump.  Each plane becomes a self
+ * contained chunk that starts with one byte saying how it was stored:
+ *
+ * CMP_RAW       The PRECISION values as they are.  Used whenever the others
+ *               would not make the chunk any smaller.
+ * CMP_SHUFFLE   Lossless.  The bytes of the values are regrouped so that all
+ *               the first bytes come first, then all the second bytes and so
+ *               on, which lines up the slowly varying sign and exponent bytes.
+ *               The result is then LZ compressed.
+ * CMP_QUANT     Lossy, with every value within tol of the original.  Values
+ *               are rounded to multiples of 2*tol, and the differences between
+ *               neighbouring multiples are shuffled and LZ compressed.  Planes
+ *               with values too large to quantize fall back to CMP_SHUFFLE.
+ *
+ * The LZ stage is a plain LZ77 in the style of LZ4, kept here so the code
+ * has no dependencies beyond MPI and FFTW.
+ ***************************/
+
+#ifndef _COMPRESS_H
+#define	_COMPRESS_H
+
+#include "Precision.h"
+
+#define CMP_RAW 0
+#define CMP_SHUFFLE 1
+#define CMP_QUANT 2
+
+/*
+ * The most bytes cmp_pack will ever produce for n values.
+ */
+int cmp_bound(int n);
+
+/*
+ * Packs n values into out, which must hold cmp_bound(n) bytes, and returns the
+ * number of bytes used.  tol <= 0 means the chunk must be lossless.
+ */
+int cmp_pack(PRECISION * in, int n, PRECISION tol, unsigned char * out);
+
+/*
+ * Inverse of cmp_pack.  len is the size of the chunk and tol is the value it
+ * was packed with.  Returns 0 on success and -1 if the chunk is corrupt.
+ */
+int cmp_unpack(unsigned char * in, int len, int n, PRECISION tol, PRECISION * out);
+
+#endif	/* _COMPRESS_H */
@@ -0,0 +1,84 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/***************************
+ * The scalar diagnostics written to the Scalars directory.  Each diagnostic is
+ * a min, max, sum or mean over the whole domain of some pointwise quantity,
+ * called a source.  A source is either a field's spatial array, read in place,
+ * or a function that fills in a block of points (e.g. the kinetic energy
+ * density from the three velocity components).
+ *
+ * diag_compute makes one pass over the local domain, a block of points at a
+ * time, so every source for a block is still in cache when the reductions get
+ * to it.  The whole record is then combined across the compute nodes with a
+ * single MPI_Reduce, using an operation that knows how each entry combines.
+ *
+ * Adding a new diagnostic is a matter of registering it in diag_init.  The
+ * order of registration is the order in the Scalars files, and the names are
+ * written into the start of each one.
+ ***************************/
+
+#ifndef _DIAGNOSTICS_H
+#define	_DIAGNOSTICS_H
+
+#include "Field.h"
+#include "Precision.h"
+
+#define DIAG_MIN 0
+#define DIAG_MAX 1
+#define DIAG_SUM 2
+#define DIAG_MEAN 3     //sum divided by the number of grid points
+
+/*
+ * Fills out[0..count-1] with a quantity at the local points start through
+ * start + count - 1 of the spatial arrays.
+ */
+typedef void (*diag_fill)(int start, int count, PRECISION * out);
+
+/*
+ * Registers the standard diagnostics and sets up the reduction.  Call once on
+ * the compute nodes, after the state variables exist.
+ */
+void diag_init();
+void diag_finalize();
+
+/*
+ * Sources.  Each returns a handle to pass to diag_add.
+ */
+int diag_addField(p_field f);
+int diag_addSource(diag_fill fill);
+
+/*
+ * Appends a diagnostic to the record.  op is one of the DIAG_ values above.
+ */
+void diag_add(const char * name, int source, int op);
+
+/*
+ * Number of diagnostics in a record, and the name of each.
+ */
+int diag_count();
+const char * diag_name(int i);
+
+/*
+ * Collective over the compute nodes.  crank 0 gets the record in out, which
+ * must hold diag_count() values.
+ */
+void diag_compute(PRECISION * out);
+
+#endif	/* _DIAGNOSTICS_H */
@@ -70,8 +70,15 @@ extern MPI_Comm fcomm;  //Communication between all io nodes
 //layout info
 extern int hdiv;         //number of compute nodes in a row
 extern int vdiv;         //number of compute nodes in a column
+extern int autoDecomp;   //hdiv and vdiv are chosen by the code
+extern int autoTrial;    //time the best few layouts before choosing
+extern int nodePlacement; //keep the heavier transpose group on one node
 extern int compute_node; //number of compute nodes (hdiv * vdiv)
 extern int io_node;      //number of io nodes
+extern int nthreads;     //number of threads each compute node runs with
+extern int fftWisdom;    //save and reuse FFTW plans between runs
+extern int fftPatient;   //plan with FFTW_PATIENT instead of FFTW_MEASURE
+extern int floatTranspose; //send fft1 transposes in single precision
 
 //Rank and size identifiers for each communication groups a processor may 
 //belong to.  The initial letter matches with the initial letter of the 
@@ -147,6 +154,17 @@ extern indexes dealias_kz;
 extern int spatialCount;
 extern int spectralCount;
 
+//Wavenumbers for the LOCAL spectral arrays, built once by initWavenumbers so
+//that spectral loops do not have to work them out for every mode.  kxTable,
+//kyTable and kzTable hold 2 pi k / L (the derivative is i times this), kh2Inv
+//is 1/(kx^2+ky^2) for each [kx][ky] column and k2Inv is 1/k^2 for each mode.
+//Both inverses are 0 where the wavenumber is 0.
+extern PRECISION * kxTable;
+extern PRECISION * kyTable;
+extern PRECISION * kzTable;
+extern PRECISION * kh2Inv;
+extern PRECISION * k2Inv;
+
 //Describes how the computational grid is distributed among IO nodes
 extern indexes * io_layers;
 extern int my_io_layer;
@@ -168,6 +186,17 @@ extern int scalarRate;     //iterations between scalar reductions
 extern int scalarPerF;     //number of scalar outputs to be placed in one file
 extern int checkRate;      //How frequently to save simulation state
 extern int checkDir;       //Checkpointing alternates between two directions.
+#define COMPRESS_OFF 0        //raw arrays, as read by older tools
+#define COMPRESS_LOSSLESS 1   //byte shuffle and LZ, see Compress.h
+#define COMPRESS_LOSSY 2      //quantized to within the tolerances below
+extern int spatialCompression;
+extern PRECISION uTol;     //largest error allowed in lossy spatial dumps,
+extern PRECISION vTol;     //0 keeps that field lossless
+extern PRECISION wTol;
+extern PRECISION TTol;
+extern PRECISION BxTol;
+extern PRECISION ByTol;
+extern PRECISION BzTol;
 
 //physics terms
 extern int momEquation;
@@ -183,6 +212,9 @@ extern int tempAdvection;
 extern int tempBackground;
 extern int magDiff;
 extern int magAdvect;
+#define NONLINEAR_DIVERGENCE 0  //advection and Lorentz force as div(alpha BB - uu)
+#define NONLINEAR_ROTATIONAL 1  //as u x curl(u) + alpha curl(B) x B
+extern int nonlinearForm;
 
 //forcing terms
 extern int momStaticForcing;
@@ -218,12 +250,31 @@ extern int maxSteps;              //end simulation after this many iterations
 extern PRECISION maxTime;         //end simulation after this much sim time
 extern int iteration;             
 extern PRECISION safetyFactor;
+#define DIFFUSE_EXPLICIT 0    //part of the forces, so it limits dt
+#define DIFFUSE_EXACT 1       //integrating factor, exact for every mode
+#define DIFFUSE_IMPLICIT 2    //Crank-Nicolson, with AB for the other terms
+extern int diffusionMethod;
+#define INTEGRATE_AB3 0       //Adams-Bashforth, keeps three past forces
+#define INTEGRATE_RK3 1       //Williamson low storage Runge-Kutta
+#define INTEGRATE_RK4 2       //Carpenter-Kennedy 5 stage, 4th order
+extern int integrator;
+extern int historyStart;          //iteration the AB force history starts at
 extern PRECISION dt;
 extern PRECISION dt1;
 extern PRECISION dt2;
 extern PRECISION elapsedTime;
 
-extern char infostro[];
+//benchmarking (see Benchmark.c).  The lists are kept as they appear in the
+//configuration file and are only picked apart when a benchmark starts.
+extern char * benchDecomps;       //hdivxvdiv pairs, e.g. "2x2 4x2 4x4"
+extern char * benchGrids;         //nxxnyxnz triples, e.g. "64x64x64"
+extern char * benchPhysics;       //term sets: config hydro thermal mhd full
+extern char * benchFFTs;          //transform strategies, e.g. "1 2 3 4"
+extern int benchSteps;            //timed iterations for each case
+extern int benchWarmup;           //untimed iterations before those
+extern int benchRepeats;          //forward/backward transform pairs timed
+extern char * benchOutput;        //results go to <benchOutput>.csv and .json
+
 extern char infostri[];
 
 #endif	/* _ENVIRONMENT_H */
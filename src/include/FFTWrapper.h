@@ -40,6 +40,17 @@ extern "C" {
     void fft_execute_c2c(FFT_PLAN plan, FFT_COMPLEX * in, FFT_COMPLEX * out);
     void fft_execute_c2r(FFT_PLAN plan, FFT_COMPLEX * in, PRECISION * out);
 
+    void fft_destroy_plan(FFT_PLAN plan);
+
+    //Both return nonzero on success
+    int fft_import_wisdom(const char * filename);
+    int fft_export_wisdom(const char * filename);
+
+    //Plans created after fft_plan_with_nthreads use that many threads
+    void fft_init_threads();
+    void fft_plan_with_nthreads(int nthreads);
+    void fft_cleanup_threads();
+
     FFT_PLAN fft_plan_r2c(int rank, const int *n, int howmany,
                           PRECISION *in, const int *inembed,
                           int istride, int idist,
@@ -31,7 +31,8 @@
  * These data structs are designed for time AB3 time integration of pseudo-
  * spectral data fields. Data must be stored in both spatial and spectral
  * coordinates (before and after FFT), and we also need the past three
- * forcing evaluations for time integration.  
+ * forcing evaluations for time integration.  The Runge-Kutta integrators only
+ * use force1 and force2, and leave force3 unallocated.
  */
 typedef struct
 {
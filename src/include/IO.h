@@ -54,11 +54,24 @@ void finalizeIO();
  *   name :  path to the file we wish to write, relative to the directory that
  *           the simulation is running in.
  * 
+ * writeSpatial makes a dump holding just the one field.  readSpatialField 
+ * reads the named field out of a dump, such as one of the Spatial outputs,
+ * and readSpatial reads its first field.  Both also take a bare [z][y][x]
+ * array of the field with no header.
+ * 
  * Note: This routine involves MPI collectives, so EVERY processor must call it 
  *       in order to avoid deadlocks. 
  */
 void writeSpatial(p_field f, char * name);
 void readSpatial(p_field f, char * name);
+void readSpatialField(p_field f, char * name, char * fieldName);
+
+/*
+ * Returns 1 and fills in the iteration and simulation time it was written at
+ * if name is a spatial dump, and 0 if it is anything else.  Only reads the
+ * header, so any process can call it on its own.
+ */
+int spatialDumpInfo(char * name, int * iter, PRECISION * time);
 
 /*
  * Read-write checkpoints.  The location is determined automatically, and only
@@ -68,10 +81,19 @@ void writeCheckpoint();
 void readCheckpoint();
 
 /*
- * Entry point for IO operations.  Call this routine once per iteration, and
- * it will automatically perform the various types of IO operations as needed.
+ * Entry point for IO operations.  Compute nodes call this routine once per
+ * iteration, and it will automatically perform the various types of IO 
+ * operations as needed.  Spatial dumps and checkpoints are only handed off to
+ * the IO nodes here, so this never waits on a file write.
  */
 void performOutput();
 
+/*
+ * IO nodes call this instead of iterating.  It writes out the spatial dumps
+ * and checkpoints sent by performOutput and returns once the compute nodes
+ * call finalizeIO().
+ */
+void ioService();
+
 #endif	/* _IO_H */
 
@@ -33,6 +33,18 @@ void lab_initGeometry();
 void lab_initGroups();
 void lab_initDistributions();
 
+/*
+ * Fills in hdiv and vdiv when they are left to the code to choose.  Called
+ * from the init method before any of the above.
+ */
+void lab_chooseLayout();
+
+/*
+ * Logs how much of the hcomm and vcomm transposes stays within a node.  Called
+ * from the init method after the distributions are set up.
+ */
+void lab_reportTraffic();
+
 /*
  * Cleanup routine to be called from main when the program is ready to terminate
  */
@@ -43,6 +43,23 @@ inline complex PRECISION dxFactor(int i);
 inline complex PRECISION dyFactor(int i);
 inline complex PRECISION dzFactor(int i);
 
+/*
+ * Multiplies z by i k, which is all a derivative amounts to in spectral space.
+ * Written out this way each mode costs two real multiplies, rather than a full
+ * complex multiply with its checks for infinities.
+ */
+static inline complex PRECISION iMul(PRECISION k, complex PRECISION z)
+{
+    return -k * cimag(z) + I * (k * creal(z));
+}
+
+/*
+ * Fills in the wavenumber tables in Environment.h from the factors above for
+ * the current work distribution.  Called by setupEnvironment, and safe to
+ * call again if the distribution changes.
+ */
+void initWavenumbers();
+
 /*
  * These methods deal with the poloidal and toroidal decomposition.  There are
  * two decomposition routines, as sometimes we have an incompressible force and
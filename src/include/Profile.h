@@ -0,0 +1,76 @@
+/*
+ * Copywrite 2013 Benjamin Byington
+ *
+ * This file is part of the IMHD software package
+ * 
+ * IMHD is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public Liscence as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IMHD is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along 
+ * with IMHD.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/***************************
+ * A very small region profiler.  Each region is bracketed by prof_start and
+ * prof_stop, which do nothing more than read MPI_Wtime and bump a counter, so
+ * it is cheap enough to leave on in production runs.  Every statusRate steps
+ * prof_report gathers the time each compute node spent in each region since
+ * the last report and appends the min/mean/max over the nodes, the load
+ * imbalance (max / mean) and the call counts to the file "profile".
+ *
+ * Regions are inclusive and may nest, so for instance the fft region is also
+ * counted inside momentum, and step covers everything in an iteration.  A
+ * region can not be nested inside itself.
+ ***************************/
+
+#ifndef _PROFILE_H
+#define	_PROFILE_H
+
+#define PROF_STEP 0         //all of iterate()
+#define PROF_TIMESTEP 1     //calcNewTimestep()
+#define PROF_MOMENTUM 2     //calcMomentum()
+#define PROF_TEMP 3         //calcTemp()
+#define PROF_MAG 4          //calcMag()
+#define PROF_INTEGRATE 5    //step(), the time integration
+#define PROF_OUTPUT 6       //performOutput()
+#define PROF_CHECKPOINT 7   //writeCheckpoint()
+#define PROF_TRANSFORM 8    //complete parallel transforms
+#define PROF_FFT 9          //local FFTW executions
+#define PROF_PACK 10        //packing before a transpose
+#define PROF_ALLTOALL 11    //the network part of a transpose
+#define PROF_UNPACK 12      //unpacking after a transpose
+#define PROF_REGIONS 13
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Zeroes all of the counters and starts a fresh profile file.  Call once
+     * on the compute nodes, after initialization so that the test and planning
+     * transforms are not counted.
+     */
+    void prof_init();
+
+    void prof_start(int region);
+    void prof_stop(int region);
+
+    /*
+     * Collective over the compute nodes.  Writes out the interval since the
+     * last report and zeroes the counters.
+     */
+    void prof_report();
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _PROFILE_H */
+
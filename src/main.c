@@ -17,7 +17,6 @@
  * with IMHD.  If not, see <http://www.gnu.org/licenses/>
  */
 
-#include <sys/time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <mpi.h>
@@ -33,8 +32,9 @@
 #include "Physics.h"
 #include "Properties.h"
 #include "LaborDivision.h"
+#include "Profile.h"
+#include "Benchmark.h"
 
-int benchmark(char * propFile);
 int execute(char * propFile);
 
 
@@ -45,14 +45,16 @@ int execute(char * propFile);
 int main(int argc, char** argv)
 {
     int status;
+    int provided;
 
-    //Start up MPI
-    MPI_Init(&argc, &argv);
+    //Start up MPI.  Only the main thread ever communicates, even when the
+    //compute loops are threaded.
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &grank);
     MPI_Comm_size(MPI_COMM_WORLD, &gsize);
     
-    //Ensure correct calling signature.  Note: Benchmarking is not currently
-    //operative.
+    //Ensure correct calling signature.  Any second argument runs the
+    //benchmarks described in the [Benchmark] section instead of the problem.
     if(argc < 2 || argc > 3)
     {
         fprintf(stderr, "Usage: imhd <propFile> [benchmark]\n");
@@ -104,17 +106,30 @@ int execute(char * propLoc)
     if(compute_node)
     {
         initPhysics();
+        prof_init();
     }
 
-    while((iteration < maxSteps) && (elapsedTime < maxTime))
+    //IO nodes do not step along with everyone else, they just write out the
+    //spatial dumps the compute nodes send them until told to stop.
+    if(io_node)
+        ioService();
+
+    while(compute_node && (iteration < maxSteps) && (elapsedTime < maxTime))
     {
         iteration++;
         info("Working on step %d\n", iteration);
-        if(compute_node)
-            iterate();
+        prof_start(PROF_STEP);
+        iterate();
+        prof_stop(PROF_STEP);
+
+        MPI_Bcast(&elapsedTime, 1, MPI_PRECISION, 0, ccomm);
 
-        MPI_Bcast(&elapsedTime, 1, MPI_PRECISION, 0, MPI_COMM_WORLD);
+        prof_start(PROF_OUTPUT);
         performOutput();
+        prof_stop(PROF_OUTPUT);
+
+        if(iteration % statusRate == 0)
+            prof_report();
         
         //This is an experimental section where the domain moves during
         //computation to keep an item of interest centered.  Not fully
@@ -139,86 +154,3 @@ int execute(char * propLoc)
 
     return 0;
 }
-
-/*
- * Not currently functional!
- */
-int benchmark(char * propLoc)
-{
-    double dstart;
-    double dstop;
-    struct timeval start;
-    struct timeval stop;
-    
-    loadPrefs(propLoc);
-
-    //make sure we don't start running to the file system for data
-    startFlag = SCRATCH;
-    momStaticForcing = 0;
-
-    hdiv = 3;
-    vdiv = 3;
-    n_io_nodes = vdiv;
-    while(hdiv * vdiv + n_io_nodes <= gsize)
-    {
-        setupEnvironment();
-
-        initState();
-        initIO();
-        if(compute_node)
-        {
-            initPhysics();
-        }
-
-        MPI_Barrier(MPI_COMM_WORLD);
-
-        if(compute_node)
-        {
-            gettimeofday(&start,NULL);
-            int i;
-            for(i = 0; i < 100; i++)
-            {
-                fftForward(B->vec->x);
-                fftBackward(B->vec->x);
-            }
-            gettimeofday(&stop, NULL);
-            dstart = start.tv_sec+(start.tv_usec/1000000.0);
-            dstop = stop.tv_sec + (stop.tv_usec/1000000.0);
-
-            if(grank == 0)
-            {
-                fprintf(stderr, "hdiv: %d, vdiv: %d, time: %f\n", hdiv, vdiv, dstop - dstart);
-            }
-        }
-
-        MPI_Barrier(MPI_COMM_WORLD);
-
-        /*while((iteration < maxSteps) && (elapsedTime < maxTime))
-        {
-            iteration++;
-            debug("Working on step %d\n", iteration);
-            if(compute_node)
-                iterate();
-
-            MPI_Bcast(&elapsedTime, 1, MPI_PRECISION, 0, MPI_COMM_WORLD);
-            performOutput();
-        }*/
-
-        if(compute_node)
-        {
-            finalizePhysics();
-            finalizeState();
-            com_finalize();
-        }
-        lab_finalize();
-
-        hdiv++;
-        vdiv++;
-        n_io_nodes = vdiv;
-    }
-
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    return 0;
-}
-